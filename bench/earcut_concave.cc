@@ -0,0 +1,40 @@
+// Ear clipping of concave footprints alone, on a single thread. Build it with and without NO_SIMD to
+// compare the vector kernels with the scalar ones: both must print the same hash
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include "earcut.hpp"
+#include "map_data.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "fixtures.hpp"
+
+using namespace std;
+
+const size_t BUILDINGS = 5000;
+const int RUNS = 10;
+
+int main() {
+  setProjectionReference(FIXTURE_LONG, FIXTURE_LAT);
+  vector<Way> buildings = fixture_concave_buildings(BUILDINGS, 7);
+  vector<const Way*> pointers;
+  for (const Way& w : buildings) pointers.push_back(&w);
+
+  ThreadPool pool(1);
+  EarcutBatch batch;
+  double best_ms = INFINITY;
+  for (int run = 0; run < RUNS; ++run) {
+    auto start = chrono::steady_clock::now();
+    batch = earcut_buildings(pointers, MeshMode::Normals, pool);
+    best_ms = min(best_ms, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+  }
+
+#ifdef NO_SIMD
+  const char* kernels = "scalar";
+#else
+  const char* kernels = "SIMD";
+#endif
+  printf("%s: %.2f ms, %.2f us per building, %llu concave / %llu hull fallbacks per run\n", kernels, best_ms,
+    best_ms * 1000. / BUILDINGS, (unsigned long long)stats().earcut_concave / RUNS, (unsigned long long)stats().earcut_fallback / RUNS);
+  printf("hash %016llx\n", (unsigned long long)fixture_hash(batch));
+}
@@ -0,0 +1,47 @@
+// earcut_buildings over a fixed set of buildings, on pools of 1 to hardware_concurrency threads.
+// Every pool size must give the same batch as a single thread: it exits with 1 when one doesn't
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "earcut.hpp"
+#include "map_data.hpp"
+#include "thread_pool.hpp"
+#include "fixtures.hpp"
+
+using namespace std;
+
+const size_t BUILDINGS = 20000;
+const int RUNS = 5;
+
+int main() {
+  setProjectionReference(FIXTURE_LONG, FIXTURE_LAT);
+  vector<Way> buildings = fixture_buildings(BUILDINGS, 42);
+  vector<const Way*> pointers;
+  for (const Way& w : buildings) pointers.push_back(&w);
+
+  size_t max_threads = max(1u, thread::hardware_concurrency());
+  uint64_t reference_hash = 0;
+  double single_ms = 0.;
+  bool identical = true;
+  for (size_t threads = 1; threads <= max_threads; ++threads) {
+    ThreadPool pool(threads);
+    EarcutBatch batch;
+    double best_ms = INFINITY;
+    for (int run = 0; run < RUNS; ++run) {
+      auto start = chrono::steady_clock::now();
+      batch = earcut_buildings(pointers, MeshMode::Normals, pool);
+      best_ms = min(best_ms, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+
+    uint64_t hash = fixture_hash(batch);
+    if (threads == 1) {
+      reference_hash = hash;
+      single_ms = best_ms;
+    }
+    identical = identical && hash == reference_hash;
+    printf("%zu threads: %.2f ms, %.2fx, hash %016llx%s\n", threads, best_ms, single_ms / best_ms, (unsigned long long)hash,
+      hash == reference_hash ? "" : " DIFFERS from 1 thread");
+  }
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "types/map_data.hpp"
+#include "types/earcut.hpp"
+
+// Synthetic map data for the benchmarks, around the default start chunk. Everything is drawn from
+// mt19937's raw output, the standard distributions differ between standard libraries and so would
+// the fixtures and their hashes
+
+const double FIXTURE_LONG = 2.25797;
+const double FIXTURE_LAT = 48.61416;
+// width and height of the area the fixtures cover, in degrees
+const double FIXTURE_SPAN = .01;
+
+inline double fixture_unit(std::mt19937& rng) { return rng() / 4294967296.0; }
+
+// ring of n points around (lon, lat), each one between min_radius and max_radius degrees away
+inline Way fixture_star(uint64_t id, double lon, double lat, int n, double min_radius, double max_radius, std::mt19937& rng) {
+  Way w {.id = id};
+  for (int i = 0; i < n; ++i) {
+    double a = 2. * M_PI * i / n;
+    double r = min_radius + (max_radius - min_radius) * fixture_unit(rng);
+    w.nodes.push_back(Node {0, lon + r * cos(a), lat + r * sin(a), true});
+  }
+  w.nodes.push_back(w.nodes.front());
+  return w;
+}
+
+// rectangles mostly, then regular polygons, L shapes and concave stars. Half of them wind the other way
+inline std::vector<Way> fixture_buildings(size_t count, uint32_t seed) {
+  const double SIZE = .00005;
+  std::mt19937 rng(seed);
+  std::vector<Way> buildings;
+  buildings.reserve(count);
+  for (size_t b = 0; b < count; ++b) {
+    double lon = FIXTURE_LONG + FIXTURE_SPAN * fixture_unit(rng);
+    double lat = FIXTURE_LAT + FIXTURE_SPAN * fixture_unit(rng);
+    double shape = fixture_unit(rng);
+    Way w {.id = b};
+    if (shape < .55) {
+      double a = M_PI * fixture_unit(rng);
+      double hw = SIZE * (.5 + fixture_unit(rng)), hh = SIZE * (.5 + fixture_unit(rng));
+      double xs[4] = {-hw, hw, hw, -hw}, ys[4] = {-hh, -hh, hh, hh};
+      for (int i = 0; i < 4; ++i)
+        w.nodes.push_back(Node {0, lon + xs[i] * cos(a) - ys[i] * sin(a), lat + xs[i] * sin(a) + ys[i] * cos(a), true});
+      w.nodes.push_back(w.nodes.front());
+    } else if (shape < .75) {
+      w = fixture_star(b, lon, lat, 5 + rng() % 4, SIZE, SIZE, rng);
+    } else if (shape < .85) {
+      const double L[6][2] = {{0, 0}, {2, 0}, {2, 1}, {1, 1}, {1, 2}, {0, 2}};
+      for (const auto& p : L) w.nodes.push_back(Node {0, lon + p[0] * SIZE, lat + p[1] * SIZE, true});
+      w.nodes.push_back(w.nodes.front());
+    } else {
+      w = fixture_star(b, lon, lat, 6 + rng() % 20, .4 * SIZE, SIZE, rng);
+    }
+    if (rng() % 2) std::reverse(w.nodes.begin(), w.nodes.end());
+    buildings.push_back(std::move(w));
+  }
+  return buildings;
+}
+
+// concave stars of 8 to 80 vertices, for the ear clipping path alone
+inline std::vector<Way> fixture_concave_buildings(size_t count, uint32_t seed) {
+  const double SIZE = .00008;
+  std::mt19937 rng(seed);
+  std::vector<Way> buildings;
+  buildings.reserve(count);
+  for (size_t b = 0; b < count; ++b) {
+    double lon = FIXTURE_LONG + FIXTURE_SPAN * fixture_unit(rng);
+    double lat = FIXTURE_LAT + FIXTURE_SPAN * fixture_unit(rng);
+    buildings.push_back(fixture_star(b, lon, lat, 8 + rng() % 73, .3 * SIZE, SIZE, rng));
+  }
+  return buildings;
+}
+
+// random walks of 2 to 16 nodes across the highway classes, with a few repeated nodes like OSM has
+inline std::vector<Way> fixture_roads(size_t count, uint32_t seed) {
+  const char* HIGHWAYS[] = {"residential", "service", "primary", "footway", "secondary", "motorway_link"};
+  const double STEP = .0003;
+  std::mt19937 rng(seed);
+  std::vector<Way> roads;
+  roads.reserve(count);
+  for (size_t r = 0; r < count; ++r) {
+    Way w {.id = r};
+    w.tags.insert(Tag {.key = "highway", .value = HIGHWAYS[rng() % 6]});
+    double lon = FIXTURE_LONG + FIXTURE_SPAN * fixture_unit(rng);
+    double lat = FIXTURE_LAT + FIXTURE_SPAN * fixture_unit(rng);
+    int n = 2 + rng() % 15;
+    for (int i = 0; i < n; ++i) {
+      w.nodes.push_back(Node {0, lon, lat, true});
+      if (rng() % 20 == 0) w.nodes.push_back(Node {0, lon, lat, true});
+      lon += STEP * (fixture_unit(rng) - .5);
+      lat += STEP * (fixture_unit(rng) - .5);
+    }
+    roads.push_back(std::move(w));
+  }
+  return roads;
+}
+
+// FNV-1a, chained through h
+inline uint64_t fixture_hash(const void* data, size_t bytes, uint64_t h = 1469598103934665603ull) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < bytes; ++i) h = (h ^ p[i]) * 1099511628211ull;
+  return h;
+}
+
+// every field of the batch, the padding of BuildingRange left out
+inline uint64_t fixture_hash(const EarcutBatch& batch) {
+  uint64_t h = fixture_hash(batch.xs.data(), batch.xs.size() * sizeof(float));
+  h = fixture_hash(batch.ys.data(), batch.ys.size() * sizeof(float), h);
+  h = fixture_hash(batch.zs.data(), batch.zs.size() * sizeof(float), h);
+  h = fixture_hash(batch.indices.data(), batch.indices.size() * sizeof(uint32_t), h);
+  for (const BuildingRange& b : batch.buildings) {
+    uint32_t counts[4] = {b.first_vertex, b.vertex_count, b.first_index, b.index_count};
+    float geometry[8] = {b.world_offset.x, b.world_offset.y, b.occluder.min.x, b.occluder.min.y, b.occluder.min.z,
+      b.occluder.max.x, b.occluder.max.y, b.occluder.max.z};
+    uint8_t building_class = (uint8_t)b.building_class;
+    h = fixture_hash(counts, sizeof(counts), h);
+    h = fixture_hash(geometry, sizeof(geometry), h);
+    h = fixture_hash(&building_class, sizeof(building_class), h);
+  }
+  return h;
+}
@@ -0,0 +1,36 @@
+// Road tessellation throughput: build_road_mesh over a fixed set of roads, on the worker pool.
+// Prints the best of a few runs and a hash of the mesh, which must not move with optimizations
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include "map_data.hpp"
+#include "roads.hpp"
+#include "thread_pool.hpp"
+#include "fixtures.hpp"
+
+using namespace std;
+
+const size_t ROADS = 20000;
+const int RUNS = 10;
+
+int main() {
+  setProjectionReference(FIXTURE_LONG, FIXTURE_LAT);
+  vector<Way> roads = fixture_roads(ROADS, 1);
+  Vector2 origin = to2DCoords(FIXTURE_LONG, FIXTURE_LAT);
+  size_t segments = 0;
+  for (const Way& road : roads) segments += road.nodes.size() - 1;
+
+  RoadMesh mesh;
+  double best_s = INFINITY;
+  for (int run = 0; run < RUNS; ++run) {
+    auto start = chrono::steady_clock::now();
+    mesh = build_road_mesh(roads, origin, worker_pool());
+    best_s = min(best_s, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+
+  size_t triangles = mesh.vertices.size() / 3;
+  printf("%zu roads, %zu segments, %zu triangles over %zu detail levels\n", roads.size(), segments, triangles, mesh.lods.size());
+  printf("%.2f ms, %.1f M segments/s, %.1f M triangles/s on %zu workers\n", best_s * 1e3, segments / best_s / 1e6,
+    triangles / best_s / 1e6, worker_pool().size());
+  printf("hash %016llx\n", (unsigned long long)fixture_hash(mesh.vertices.data(), mesh.vertices.size() * sizeof(RoadVertex)));
+}
@@ -1,13 +1,23 @@
 #pragma once
-#include <array>
 #include <vector>
+#include <span>
+#include <chrono>
 #include "types/earcut.hpp"
+#include "types/roads.hpp"
 #include "raymath.h"
 #include "types/map_data.hpp"
 
 enum class ChunkStatus {Pending, Generating, Generated, Invalid};
 
-using Road = Way;
+// What happens to the CPU copy of a mesh once it is on the GPU
+enum class MeshRetention {
+  // freed, the chunk has to be rebuilt to get its geometry back
+  Release,
+  // kept as is, for picking or queries
+  Keep,
+  // kept compressed, materialize_meshes restores it
+  Compressed,
+};
 
 struct Chunk {
   // Build a chunk with it's internal computed values ready
@@ -22,16 +32,80 @@ struct Chunk {
   const Vector2 world_min = Vector2Zero();
   const Vector2 world_max = Vector2Zero();
   ChunkStatus status = ChunkStatus::Pending;
+  // adjacent chunks inherit it
+  MeshRetention retention = MeshRetention::Release;
+  // more of its geometry is being built, it stays Generating until the last part is uploaded
+  bool streaming = false;
+  // set by MapBuildJob: the download time counts from the request, the time to first geometry and to
+  // completion from the end of the download
+  std::chrono::steady_clock::time_point requested_at {};
+  std::chrono::steady_clock::time_point downloaded_at {};
+  // builds failed in a row, and when the streamer may request it again. Set by poll_build_job_results,
+  // the chunk turns Invalid after too many failures
+  unsigned failed_builds = 0;
+  std::chrono::steady_clock::time_point retry_at {};
 
-  void upload_meshes(std::vector<EarcutMesh>&& meshes);
-  void upload_roads(std::vector<Road>&& roads);
+  // one ChunkMeshes per detail level, 0 being the full detail. They are kept CPU side, 
+  // upload_next_mesh sends them to the GPU one mesh at a time, coarsest level first
+  void set_meshes(std::vector<ChunkMeshes>&& lods);
+  // appends a part of the buildings, level by level, to the ones already set. The parts must share
+  // their origin and MeshFrame, see MapBuildJob::JobResult
+  void add_meshes(std::vector<ChunkMeshes>&& lods);
+  // like set_meshes, but the current meshes stay drawn until every new one is uploaded
+  void replace_meshes(std::vector<ChunkMeshes>&& lods);
+  // the road mesh is uploaded along the building meshes, before them
+  void set_roads(RoadMesh&& mesh, size_t road_count);
+  // returns the uploaded bytes, 0 once every mesh is on the GPU
+  size_t upload_next_mesh();
+  size_t pending_upload_bytes() const;
+  // restores the CPU arrays of the uploaded meshes, false if they were released
+  bool materialize_meshes();
+  // frees the GPU copies, upload_next_mesh sends the CPU ones again. False without a CPU copy to
+  // upload from, the Release retention
+  bool release_gpu();
+  // mesh bytes held in RAM, compressed or not, and in the GPU buffers
+  size_t cpu_bytes() const;
+  size_t gpu_bytes() const;
   void unload();
-  std::array<std::shared_ptr<Chunk>, 8> generate_adjacents() const;
-  const std::vector<EarcutMesh>& meshes() const { return m.meshes; }
-  const std::vector<Road>& roads() const { return m.roads; }
+  size_t lod_count() const { return m.lods.size(); }
+  // every mesh of the level is on the GPU
+  bool lod_uploaded(size_t lod) const { return lod < m.lods.size() && m.uploaded_meshes[lod] == m.lods[lod].meshes.size(); }
+  // see ChunkMeshes::geometric_error
+  float lod_error(size_t lod) const { return m.lods[lod].geometric_error; }
+  // only the meshes of the level already uploaded. Their CPU arrays depend on the retention policy
+  std::span<const EarcutMesh> meshes(size_t lod = 0) const;
+  // world space bounds of meshes(lod), same order
+  std::span<const BoundingBox> meshes_bounds(size_t lod = 0) const;
+  // world space bounds of the buildings and roads, empty (min > max) until there are some
+  const BoundingBox& bounds() const { return m.bounds; }
+  // model matrix of the level's meshes, undoes their quantization
+  Matrix meshes_transform(size_t lod = 0) const;
+  // roads in road_mesh, for the HUD
+  size_t road_count() const { return m.road_count; }
+  // nothing to draw while its gpu.vao is 0
+  const RoadMesh& road_mesh() const { return m.road_mesh; }
+  Matrix roads_transform() const;
+private:
+  // upload_next_mesh without the metrics
+  size_t upload_mesh();
+  // the next mesh of the levels, coarsest level first. 0 once they are all uploaded
+  size_t upload_level_mesh(std::vector<ChunkMeshes>& lods, std::vector<size_t>& uploaded);
+  static void release_levels(std::vector<ChunkMeshes>& lods, std::vector<size_t>& uploaded);
+  void release_meshes();
+  void release_road_mesh();
+  void update_bounds();
 private:
   struct M {
-    std::vector<EarcutMesh> meshes {};
-    std::vector<Road> roads {};
+    std::vector<ChunkMeshes> lods {};
+    // per level
+    std::vector<size_t> uploaded_meshes {};
+    // replace_meshes' levels, until they are all uploaded
+    std::vector<ChunkMeshes> replacement {};
+    std::vector<size_t> replacement_uploaded {};
+    size_t road_count = 0;
+    RoadMesh road_mesh {};
+    BoundingBox bounds {};
+    // something was uploaded since the request, for the time to first geometry
+    bool shown = false;
   } m;
 };
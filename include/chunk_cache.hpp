@@ -0,0 +1,54 @@
+#pragma once
+#include <list>
+#include <span>
+#include <memory>
+#include <utility>
+#include "chunk.hpp"
+
+// Chunks that left the streaming radius, kept so that coming back to them doesn't mean downloading
+// and building them again. Past a budget, the least recently retired chunks go first: they lose their
+// GPU copy while they have a CPU one to upload again from, then they are unloaded
+class ChunkCache {
+public:
+  // for the loaded chunks and the cached ones together, see Chunk::cpu_bytes and Chunk::gpu_bytes.
+  // Loaded chunks are never evicted, they alone can go over the budgets
+  struct Budget {
+    size_t cpu_bytes;
+    size_t gpu_bytes;
+  };
+  // as of the last trim, hits and misses counting take's results
+  struct Usage {
+    size_t cpu_bytes;
+    size_t gpu_bytes;
+    size_t chunks;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+  };
+  // a chunk's place in the streaming grid
+  using Cell = std::pair<int, int>;
+public:
+  explicit ChunkCache(Budget budget);
+
+  // a Generated chunk out of range, it becomes the most recently used
+  void put(Cell cell, std::shared_ptr<Chunk> chunk);
+  // the cell's chunk, out of the cache, nullptr if it isn't cached
+  std::shared_ptr<Chunk> take(Cell cell);
+  // evicts until the loaded chunks and the cached ones fit the budgets, or nothing is left to evict
+  void trim(std::span<const std::shared_ptr<Chunk>> loaded);
+  // unloads every cached chunk
+  void clear();
+  const Budget& budget() const { return m.budget; }
+  const Usage& usage() const { return m.usage; }
+private:
+  struct Entry {
+    Cell cell;
+    std::shared_ptr<Chunk> chunk;
+  };
+  struct M {
+    Budget budget;
+    // least recently used first
+    std::list<Entry> entries = {};
+    Usage usage = {};
+  } m;
+};
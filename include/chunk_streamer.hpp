@@ -0,0 +1,57 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "raylib.h"
+#include "chunk.hpp"
+#include "map_build_job.hpp"
+#include "upload_queue.hpp"
+#include "chunk_cache.hpp"
+
+// Keeps the chunks around the camera loaded. Chunks tile the world on a grid set by the start chunk,
+// the ones within the load radius are requested nearest first, those ahead of the camera before those
+// behind it, and the loaded ones past the unload radius are retired to the cache
+class ChunkStreamer {
+public:
+  // distances are from the camera to the chunk's rectangle, on the ground, in world units
+  struct Config {
+    float load_radius;
+    // larger than load_radius so that flying along its edge doesn't load and retire the same chunks over and over
+    float unload_radius;
+    // chunks downloaded or built at once, see MapBuildJob::requests_in_flight. The OSM API doesn't
+    // like many requests in parallel
+    size_t max_requests;
+  };
+  // since the streamer started, for the HUD
+  struct Counters {
+    size_t requested;
+    size_t retired;
+  };
+public:
+  // the start chunk is the grid's cell (0, 0), the other chunks inherit its retention
+  ChunkStreamer(std::shared_ptr<Chunk> start_chunk, Config config);
+
+  // requests and retires chunks for the camera's position, once per frame, then trims the cache.
+  // Retired chunks go to the cache once Generated, the others are cancelled and unloaded
+  void update(Vector3 camera_position, Vector3 camera_target, MapBuildJob& build_job, UploadQueue& upload_queue, 
+    ChunkCache& cache);
+  // only changed by update
+  const std::vector<std::shared_ptr<Chunk>>& chunks() const { return m.chunks; }
+  const Counters& counters() const { return m.counters; }
+private:
+  std::shared_ptr<Chunk> make_chunk(int x, int z) const;
+  // closest distance from p to the cell's rectangle
+  float distance_to_cell(Vector2 p, int x, int z) const;
+private:
+  struct M {
+    Config config;
+    // world_min of the cell (0, 0) and world size of a cell, y being negative when going north
+    Vector2 grid_origin;
+    Vector2 cell_size;
+    MeshRetention retention;
+    std::map<std::pair<int, int>, std::shared_ptr<Chunk>> cells = {};
+    std::vector<std::shared_ptr<Chunk>> chunks = {};
+    Counters counters = {};
+  } m;
+};
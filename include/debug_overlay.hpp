@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "raylib.h"
+
+// Chunk markers and status planes, drawn with one instanced draw call per shape from a buffer
+// refilled every frame. Shapes added while it's disabled cost nothing.
+// Needs the GL context: load after InitWindow, unload before CloseWindow
+class DebugOverlay {
+public:
+  // the last frame's overlay alone, for the HUD
+  struct Counters {
+    size_t instances;
+    size_t draw_calls;
+    // spent in draw(): instance upload and draw calls
+    double cpu_ms;
+  };
+public:
+  void load();
+  void unload();
+
+  void set_enabled(bool enabled) { m.enabled = enabled; }
+  bool enabled() const { return m.enabled; }
+
+  void add_sphere(Vector3 center, float radius, Color color);
+  // flat on the ground (XZ), size being along x and z like DrawPlane
+  void add_plane(Vector3 center, Vector2 size, Color color);
+  // draws and empties the frame's shapes, between BeginMode3D and EndMode3D.
+  // They are transparent, drawn after the opaque geometry without writing depth and far to near from camera
+  void draw(Vector3 camera);
+  const Counters& counters() const { return m.counters; }
+private:
+  struct Instance {
+    float center[3];
+    float scale[3];
+    uint8_t color[4];
+  };
+  // a unit mesh and the instances drawn with it
+  struct Shape {
+    unsigned int vao = 0;
+    unsigned int vbo = 0;
+    unsigned int ebo = 0;
+    unsigned int instance_vbo = 0;
+    int index_count = 0;
+    size_t instance_capacity = 0;
+    std::vector<Instance> instances = {};
+  };
+  static Shape load_shape(const std::vector<Vector3>& positions, const std::vector<uint16_t>& indices);
+  static void unload_shape(Shape& shape);
+  // grows the instance buffer when needed, then uploads the instances
+  static void upload_instances(Shape& shape);
+  // far to near, for the blending to come out right where they overlap
+  static void sort_instances(Shape& shape, Vector3 camera);
+private:
+  struct M {
+    bool enabled = true;
+    Shader shader {};
+    int mvp_location = -1;
+    Shape sphere {};
+    Shape plane {};
+    Counters counters {};
+  } m;
+};
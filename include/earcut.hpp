@@ -1,26 +1,48 @@
 #pragma once
-#include <ranges>
+#include <span>
 #include <vector>
-#include <tuple>
+#include <optional>
 #include <memory>
 #include "raylib.h"
 #include "types/earcut.hpp"
 #include "types/map_data.hpp"
+#include "thread_pool.hpp"
 
-EarcutResult earcut_single(const Way& w);
+BuildingClass building_class(const Way& building);
+// default palette colour of a class
+Color building_color(BuildingClass building_class);
 
-template <typename Pred>
-using WayFilterView = std::ranges::filter_view<std::ranges::ref_view<std::vector<Way>>, Pred>;
+// Triangulates a building's footprint into walls and roof, appending the result to out
+void earcut_single(const Way& w, EarcutBatch& out, MeshMode mode);
 
-template <typename Pred>
-std::vector<EarcutResult> earcut_collection(WayFilterView<Pred>&& buildings) {
-  std::vector<EarcutResult> earcuts;
+// Triangulates all the buildings across the pool's workers. The output is the same whatever the pool size
+EarcutBatch earcut_buildings(std::span<const Way* const> buildings, MeshMode mode, ThreadPool& pool);
+// Appends other's buildings to batch's, as if they had been triangulated together
+void append_batch(EarcutBatch& batch, const EarcutBatch& other);
 
-  for (const Way& w : buildings) {
-    earcuts.push_back(earcut_single(w));
-  }
+// Orders the buildings block by block along a Z-order curve and returns where each batch starts, plus the end.
+// Batches grow from first_batch buildings up to max_batch, never splitting a level 2 block, for chunks
+// built and shown in parts: the first ones show up fast, the later ones don't multiply the meshes
+std::vector<size_t> progressive_batches(std::vector<const Way*>& buildings, size_t first_batch, size_t max_batch);
+// The frame build_meshes would fit to all the buildings, computed from their nodes before any triangulation
+MeshFrame fit_mesh_frame(std::span<const Way* const> buildings, Vector2 origin);
 
-  return earcuts;
-}
+// Packs the batch into merged meshes, one or more per spatial cluster, quantized relative to origin.
+// Without a frame, it is fitted to the batch
+ChunkMeshes build_meshes(const EarcutBatch& batch, Vector2 origin, MeshMode mode, std::optional<MeshFrame> frame = std::nullopt);
 
-std::vector<EarcutMesh> build_meshes(const std::vector<EarcutResult>& earcuts);
+// Detail levels of a chunk's buildings, 0 being the full detail
+const int LOD_COUNT = 3;
+
+// Every detail level of the batch's buildings, built on the pool's workers:
+// - level 0 is build_meshes(batch, ...), counted in the mesh stats unless counted is false: for meshes
+//   replaced later by those of a bigger batch, which would count the buildings twice
+// - level 1 simplifies the footprints, Visvalingam-Whyatt style without letting them cross themselves. Its
+//   geometric error is the farthest a removed vertex ended up from its footprint
+// - level 2 merges the buildings of each block into the extrusion of their convex hull
+std::vector<ChunkMeshes> build_lod_meshes(const EarcutBatch& batch, Vector2 origin, MeshMode mode, ThreadPool& pool,
+  std::optional<MeshFrame> frame = std::nullopt, bool counted = true);
+
+// Lossless delta + varint encoding of a mesh's CPU arrays, for meshes kept around after their upload
+void compress_mesh(EarcutMesh& mesh);
+void decompress_mesh(EarcutMesh& mesh);
@@ -0,0 +1,18 @@
+#pragma once
+#include <span>
+#include <cstdint>
+#include "raylib.h"
+
+// View frustum as 6 planes (a, b, c, d), a point p being inside when a*x + b*y + c*z + d >= 0 for all of them
+struct Frustum {
+  Vector4 planes[6];
+};
+
+enum class Containment {Outside, Intersects, Inside};
+
+// view_projection maps world to clip space, MatrixMultiply(view, projection) in raylib's order
+Frustum make_frustum(Matrix view_projection);
+
+Containment box_in_frustum(const Frustum& frustum, const BoundingBox& box);
+// sets visible[i] for the boxes at least partially inside, 4 boxes at a time
+void boxes_in_frustum(const Frustum& frustum, std::span<const BoundingBox> boxes, std::span<uint8_t> visible);
@@ -0,0 +1,44 @@
+#pragma once
+#include <map>
+#include <tuple>
+#include <vector>
+#include <span>
+#include <cstdint>
+#include "types/gpu_mesh.hpp"
+
+// Recycles the GPU buffers of unloaded meshes so that streaming chunks in and out doesn't
+// allocate from the driver each time. Buffers are sized in power of two buckets, a mesh 
+// reuses a free slab of its bucket and only updates its content
+class GpuBufferPool {
+public:
+  // free slabs past max_free_bytes are given back to the driver
+  explicit GpuBufferPool(size_t max_free_bytes);
+
+  GpuBufferPool(const GpuBufferPool&) = delete;
+  GpuBufferPool& operator=(const GpuBufferPool&) = delete;
+
+  // indices may be empty, for meshes drawn without them
+  GpuMesh acquire(const void* vertices, int vertices_bytes, VertexLayout layout, std::span<const uint16_t> indices);
+  void release(GpuMesh& mesh);
+  // frees the free slabs, must happen while the GL context is alive
+  void trim();
+private:
+  GpuMesh allocate_slab(int vertex_capacity, int index_capacity, VertexLayout layout);
+  void free_slab(GpuMesh& slab);
+  void update_stats() const;
+private:
+  // vertex layout, vertex capacity, index capacity
+  using Bucket = std::tuple<VertexLayout, int, int>;
+
+  struct M {
+    size_t max_free_bytes = 0;
+    std::map<Bucket, std::vector<GpuMesh>> free_slabs = {};
+    size_t free_bytes = 0;
+    size_t capacity_bytes = 0;
+    size_t used_bytes = 0;
+    size_t slabs = 0;
+  } m;
+};
+
+// Pool backing upload_gpu_mesh and unload_gpu_mesh
+GpuBufferPool& gpu_buffer_pool();
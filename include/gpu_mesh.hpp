@@ -0,0 +1,31 @@
+#pragma once
+#include <span>
+#include <cstdint>
+#include "raylib.h"
+#include "types/gpu_mesh.hpp"
+#include "types/roads.hpp"
+
+// raylib's UploadMesh/DrawMesh only know about float attributes, 
+// these upload and draw PackedVertex meshes through rlgl directly.
+// Buffers are recycled through gpu_buffer_pool()
+GpuMesh upload_gpu_mesh(std::span<const PackedVertex> vertices, std::span<const uint16_t> indices);
+GpuMesh upload_gpu_mesh(std::span<const PackedPosition> positions, std::span<const uint16_t> indices);
+GpuMesh upload_gpu_mesh(std::span<const RoadVertex> vertices);
+void unload_gpu_mesh(GpuMesh& mesh);
+// meshes without indices are drawn as plain triangle lists
+void draw_gpu_mesh(const GpuMesh& mesh, const Material& mat, Matrix transform);
+// one draw call per range, for the parts of a mesh left after culling or of its detail level
+void draw_gpu_mesh(const GpuMesh& mesh, const Material& mat, Matrix transform, std::span<const IndexRange> ranges);
+// The same in steps, for runs of meshes sharing a material: the shader is enabled once for all of them.
+// Empty ranges draw the whole mesh, returns the number of draw calls
+void begin_gpu_material(const Material& mat);
+size_t draw_bound_gpu_mesh(const GpuMesh& mesh, const Material& mat, Matrix transform, std::span<const IndexRange> ranges);
+void end_gpu_material();
+
+// Colours the shaders look up with the feature class attribute, one per class.
+// Restyling is only this uniform update, the meshes stay as they are
+const int PALETTE_SIZE = 8;
+void set_palette(const Material& mat, std::span<const Color> colors);
+
+// encodes a unit vector
+void oct_encode(Vector3 n, int8_t out[2]);
@@ -1,8 +1,12 @@
 #pragma once
 #include <vector>
+#include <list>
 #include <queue>
+#include <mutex>
+#include <atomic>
 #include "curl/curl.h"
 #include "chunk.hpp"
+#include "thread_pool.hpp"
 #include <memory>
 #include <expected>
 #include <variant>
@@ -10,11 +14,20 @@
 
 class MapBuildJob {
 public:
+  // A chunk comes in parts as it is built, each one adding to the previous ones: the roads first,
+  // then the buildings batch by batch, all sharing the chunk's MeshFrame. Once every batch is out, the
+  // whole chunk's meshes come last to replace the parts', as many as a build in one go would give.
+  // Parts only start once the download is over, they don't make slow downloads show up sooner
   struct JobResult {
-    // if i feel like it, i'll make a proper "Road" type someday instead of using the raw
-    // parsed data
-    std::vector<Way> roads;
-    std::vector<EarcutMesh> meshes;
+    // the parsed roads are dropped once meshed, only their count is kept
+    size_t road_count;
+    RoadMesh road_mesh;
+    // building meshes of every detail level, for this part's buildings
+    std::vector<ChunkMeshes> lods;
+    // lods holds every building of the chunk, see Chunk::replace_meshes
+    bool whole;
+    // nothing else comes for the chunk
+    bool last;
   };
 
   struct ErrorHttp {
@@ -33,26 +46,49 @@ public:
     std::shared_ptr<Chunk> target = nullptr;
     CURL* curl = nullptr;
     std::string data = {};
-    bool done = false;
   };
 public:
-  MapBuildJob();
+  explicit MapBuildJob(MeshMode mesh_mode = MeshMode::Normals);
   ~MapBuildJob();
 
+  // adds the chunks to the job, starting it if it isn't ongoing
   void start(const std::vector<std::shared_ptr<Chunk>>& chunks);
+  // drops the chunk's download, or stops its build before the next batch. Parts already built still
+  // come out of poll
+  void cancel(const std::shared_ptr<Chunk>& chunk);
+  // downloads and builds not over yet, cancelled builds included until they stop
+  size_t requests_in_flight() const { return m.ongoing.size() + m.builds.size(); }
+  // the parts built since the last call. Downloaded chunks are built on a thread of their own
   std::queue<ExpectedJobResult> poll();
   bool finished() const { return m.state == State::Finished; };
-  bool ongoing() const { return m.state == State::Working; };
-  // returns true if the last call to poll ended the job
-  bool just_finished() const { return m.just_finished; }
 private:
-  std::expected<JobResult,JobError> try_build_job_result(OngoingJob& ongoing_job);
+  // shared by the main thread and the chunk's build task
+  struct BuildFlags {
+    std::atomic<bool> cancelled = false;
+    std::atomic<bool> done = false;
+  };
+  struct Build {
+    std::shared_ptr<Chunk> target;
+    std::shared_ptr<BuildFlags> flags;
+  };
+  // runs on the builder thread, publishing the chunk's parts as they are done
+  void build(std::shared_ptr<Chunk> target, std::string data, const BuildFlags& flags);
+  void publish(ExpectedJobResult result);
 private:
   enum class State {AwaitingStart, Working, Finished};
   struct M {
-    std::vector<OngoingJob> ongoing = {};
+    // a list, curl writes into the jobs' data while others come and go
+    std::list<OngoingJob> ongoing = {};
     CURLM* curlm = nullptr;
     State state = State::AwaitingStart;
-    bool just_finished = false;
+    MeshMode mesh_mode = MeshMode::Normals;
+    // parts built and not yet returned by poll
+    std::queue<ExpectedJobResult> published = {};
+    std::mutex published_mtx = {};
+    // chunks handed to the builder, until poll sees them done
+    std::vector<Build> builds = {};
+    // last, so that it is joined before the rest goes away. Chunks are built one at a time, each
+    // spreading over the worker pool
+    ThreadPool builder {1};
   } m;
 };
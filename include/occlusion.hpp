@@ -0,0 +1,38 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "raylib.h"
+
+// Low resolution depth buffer rasterized on the CPU from occluder boxes, then queried with bounding boxes.
+// It never touches the GPU, it can be filled and queried from any thread (one at a time)
+class OcclusionBuffer {
+public:
+  // width must be a multiple of 4
+  OcclusionBuffer(int width, int height);
+
+  // empties the buffer, view_projection maps world to clip space as in make_frustum
+  void clear(Matrix view_projection);
+  // the box must be inside solid geometry. Boxes crossing the near plane are skipped
+  void add_occluder(const BoundingBox& box);
+  // false when every pixel the box covers holds a nearer occluder
+  bool is_visible(const BoundingBox& box) const;
+
+  int width() const { return m.width; }
+  int height() const { return m.height; }
+  // 1/w of the nearest occluder per pixel, row major from the top left, 0 where there is none
+  std::span<const float> depth() const { return m.depth; }
+private:
+  struct Corner {
+    float x, y, inv_w;
+  };
+  // false when the box crosses the near plane
+  bool project_box(const BoundingBox& box, Corner corners[8]) const;
+  void rasterize_quad(const Corner& a, const Corner& b, const Corner& c, const Corner& d);
+private:
+  struct M {
+    int width = 0;
+    int height = 0;
+    Matrix view_projection {};
+    std::vector<float> depth = {};
+  } m;
+};
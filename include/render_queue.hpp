@@ -0,0 +1,44 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "raylib.h"
+#include "types/gpu_mesh.hpp"
+
+// A GPU mesh, or the given parts of it. Empty ranges draw the whole mesh
+struct MeshDraw {
+  const GpuMesh* mesh;
+  const Material* material;
+  Matrix transform;
+  std::span<const IndexRange> ranges;
+};
+
+struct DrawItem {
+  MeshDraw draw;
+  // distance to the camera, items sharing a state are drawn front to back
+  float depth;
+};
+
+// Collects a frame's draws, then issues them sorted so that items sharing a shader and a material
+// follow each other, front to back within a state. Everything in it is opaque: the transparent
+// debug shapes go through DebugOverlay, which sorts them itself
+class RenderQueue {
+public:
+  // what flush did, for the last frame
+  struct Counters {
+    size_t items;
+    size_t draw_calls;
+    size_t shader_changes;
+    size_t material_changes;
+  };
+public:
+  // whatever the item points to (mesh, material, ranges) must live until flush
+  void submit(DrawItem item);
+  // draws and empties the queue, between BeginMode3D and EndMode3D
+  void flush();
+  const Counters& counters() const { return m.counters; }
+private:
+  struct M {
+    std::vector<DrawItem> items = {};
+    Counters counters = {};
+  } m;
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <vector>
+#include "raylib.h"
+#include "types/roads.hpp"
+#include "types/map_data.hpp"
+#include "thread_pool.hpp"
+
+RoadClass road_class(const Way& road);
+Color road_color(RoadClass road_class);
+// full width of the ribbon, in world units
+float road_width(RoadClass road_class);
+
+// Appends the road as a ribbon of its class' width, with miter joins (bevel ones at sharp turns).
+// The centerline is first simplified with Douglas-Peucker when tolerance is above 0
+void tessellate_road(const Way& road, Vector2 origin, std::vector<RoadVertex>& out, float tolerance = 0.f);
+// Tessellates all the roads across the pool's workers, relative to origin, once per detail level.
+// Coarser levels simplify the centerlines further and drop the smaller road classes
+RoadMesh build_road_mesh(const std::vector<Way>& roads, Vector2 origin, ThreadPool& pool);
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// 4-wide kernels use the compiler's vector extensions so that they map to SSE on x86 and NEON on arm.
+// Define NO_SIMD to only build the scalar kernels, both must produce the exact same output
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_SIMD)
+#define HAS_SIMD 1
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+static inline f32x4 load4(const float* p) { f32x4 v; memcpy(&v, p, sizeof(v)); return v; }
+static inline void store4(float* p, f32x4 v) { memcpy(p, &v, sizeof(v)); }
+static inline f32x4 splat4(float f) { return f32x4 {f, f, f, f}; }
+static inline i32x4 splat4_i(int32_t i) { return i32x4 {i, i, i, i}; }
+static inline bool any4(i32x4 m) { return (m[0] | m[1] | m[2] | m[3]) != 0; }
+static inline f32x4 select4(i32x4 m, f32x4 a, f32x4 b) { return (f32x4)(((i32x4)a & m) | ((i32x4)b & ~m)); }
+static inline f32x4 abs4(f32x4 v) { return (f32x4)((i32x4)v & splat4_i(0x7fffffff)); }
+#endif
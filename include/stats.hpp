@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Counters gathered along the build pipeline so they can be displayed in the HUD.
+// Stored as atomics since nothing guarantees the build stages run on the main thread
+struct Stats {
+  // which triangulation path the building roofs went through
+  std::atomic<uint64_t> earcut_quad {0};
+  std::atomic<uint64_t> earcut_convex {0};
+  std::atomic<uint64_t> earcut_concave {0};
+  // concave rings that could not be ear clipped and were roofed with their convex hull
+  std::atomic<uint64_t> earcut_fallback {0};
+  // rings left with less than 3 vertices or no area once cleaned, they get no geometry
+  std::atomic<uint64_t> earcut_degenerate {0};
+  // cumulated time spent in earcut_buildings
+  std::atomic<uint64_t> earcut_ns {0};
+  // cumulated time spent building the coarser detail levels, triangulation and meshes
+  std::atomic<uint64_t> lod_ns {0};
+  // CPU side bytes of the full detail building meshes built so far (vertices, normals and indices)
+  std::atomic<uint64_t> mesh_bytes {0};
+  std::atomic<uint64_t> buildings_meshed {0};
+  // CPU side bytes of the meshes held by chunks, uploaded or not
+  std::atomic<uint64_t> resident_mesh_bytes {0};
+  // GPU buffer pool: slabs and their bytes, free ones included, and the bytes meshes actually use
+  std::atomic<uint64_t> gpu_pool_slabs {0};
+  std::atomic<uint64_t> gpu_pool_capacity_bytes {0};
+  std::atomic<uint64_t> gpu_pool_free_bytes {0};
+  std::atomic<uint64_t> gpu_pool_used_bytes {0};
+  std::atomic<uint64_t> gpu_pool_allocations {0};
+  std::atomic<uint64_t> gpu_pool_reuses {0};
+  // finished chunks and mesh bytes waiting for their GPU upload
+  std::atomic<uint64_t> upload_backlog_chunks {0};
+  std::atomic<uint64_t> upload_backlog_bytes {0};
+  // from a chunk's request to the end of its download
+  std::atomic<uint64_t> download_ns {0};
+  std::atomic<uint64_t> download_chunks {0};
+  // from the end of a chunk's download to its first mesh on the GPU, and to its last one
+  std::atomic<uint64_t> first_geometry_ns {0};
+  std::atomic<uint64_t> first_geometry_chunks {0};
+  std::atomic<uint64_t> complete_ns {0};
+  std::atomic<uint64_t> complete_chunks {0};
+
+  uint64_t earcut_buildings() const noexcept { return earcut_quad + earcut_convex + earcut_concave + earcut_degenerate; }
+};
+
+Stats& stats();
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+
+// Fixed size pool of worker threads consuming a FIFO of tasks
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  std::future<void> submit(std::function<void()> task);
+  size_t size() const { return m.workers.size(); }
+private:
+  void worker_loop();
+private:
+  struct M {
+    std::vector<std::thread> workers = {};
+    std::queue<std::packaged_task<void()>> tasks = {};
+    std::mutex mtx = {};
+    std::condition_variable cv = {};
+    bool stopping = false;
+  } m;
+};
+
+// Pool shared by the build stages, sized after the number of hardware threads
+ThreadPool& worker_pool();
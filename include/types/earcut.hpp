@@ -1,15 +1,91 @@
 #pragma once
-#include <tuple>
+#include <cstdint>
 #include <vector>
 #include "raylib.h"
+#include "types/gpu_mesh.hpp"
 
-using Triangle = std::tuple<Vector3, Vector3, Vector3>;
-struct EarcutResult {
-  std::vector<Triangle> triangles;
+enum class MeshMode {
+  // per vertex normals, walls and roof are split at hard edges
+  Normals,
+  // no normal stream, flat_shade.fs derives face normals from screen space derivatives.
+  // Vertices are shared between walls and roof
+  DerivedNormals,
+};
+
+// Coarse grouping of a building's tags, it picks the building's colour in flat_shade.fs' palette
+enum class BuildingClass : uint8_t {Other, Residential, Commercial, Industrial, Public};
+
+// Where a single building lives inside an EarcutBatch.
+// Its indices are relative to first_vertex
+struct BuildingRange {
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  uint32_t first_index;
+  uint32_t index_count;
   Vector2 world_offset;
+  BuildingClass building_class;
+  // box inside the building relative to world_offset, empty (min > max) when none was found.
+  // Anything it hides is hidden by the building too
+  BoundingBox occluder;
+};
+
+// Triangulation output for all the buildings of a chunk, appended one after the other.
+// Vertex coordinates are stored in separate arrays (SoA), y being the elevation
+struct EarcutBatch {
+  std::vector<float> xs;
+  std::vector<float> ys;
+  std::vector<float> zs;
+  std::vector<uint32_t> indices;
+  std::vector<BuildingRange> buildings;
+};
+
+// Buildings merged into a mesh, in mesh order (SoA), so that they can be culled one by one
+struct MeshBuildings {
+  // world space
+  std::vector<BoundingBox> bounds;
+  // world space, see BuildingRange::occluder
+  std::vector<BoundingBox> occluders;
+  // where each building's triangles are in the mesh's indices
+  std::vector<IndexRange> indices;
 };
 
+// Only one of vertices or positions is filled, depending on the MeshMode
+// Once compressed, the arrays are emptied and only compressed holds the geometry.
+// buildings stays whatever the retention, it isn't counted in cpu_bytes
 struct EarcutMesh {
-  Mesh mesh;
-  Vector2 world_offset;
+  std::vector<PackedVertex> vertices;
+  std::vector<PackedPosition> positions;
+  std::vector<uint16_t> indices;
+  std::vector<uint8_t> compressed;
+  MeshBuildings buildings;
+  GpuMesh gpu;
+
+  size_t cpu_bytes() const noexcept { 
+    return vertices.size()*sizeof(PackedVertex) + positions.size()*sizeof(PackedPosition) + indices.size()*sizeof(uint16_t) + compressed.size(); 
+  }
+};
+
+// Quantization scale and cluster grid of a chunk's meshes. When a chunk is built in several parts,
+// they all use the chunk's frame so that their meshes can be appended to each other
+struct MeshFrame {
+  // world units per quantization step
+  float position_scale;
+  // cluster grid, over the building centers relative to the origin
+  Vector2 grid_min;
+  Vector2 grid_max;
+};
+
+// Building meshes of a chunk, they share the same quantization of their vertex positions.
+// Buildings are merged by spatial cluster, a cluster being split to stay under the 16 bits index limit
+struct ChunkMeshes {
+  // world position of the vertices' (0,0,0)
+  Vector2 origin;
+  // world units per quantization step
+  float position_scale;
+  MeshMode mode;
+  // how far the meshes' surfaces can be from the actual buildings, in world units. 0 at full detail
+  float geometric_error;
+  std::vector<EarcutMesh> meshes;
+  // world space bounds of each mesh
+  std::vector<BoundingBox> bounds;
 };
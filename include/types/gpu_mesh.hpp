@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+// Compact vertex format of the chunk meshes (12 bytes instead of 24):
+// - position relative to the chunk origin, quantized with the chunk's position scale
+// - octahedral encoded unit normal
+// - feature class, the shader's palette index (a BuildingClass). The padding makes the stride a multiple
+//   of 4, drivers repack other strides on upload (GL over Metal on macOS does)
+struct PackedVertex {
+  int16_t position[3];
+  int8_t normal[2];
+  uint8_t feature;
+  uint8_t padding[3];
+};
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must stay tightly packed, it's uploaded as is");
+
+// PackedVertex without its normal, for meshes whose normals are derived in the fragment shader
+struct PackedPosition {
+  int16_t position[3];
+  uint8_t feature;
+  uint8_t padding;
+};
+static_assert(sizeof(PackedPosition) == 8, "PackedPosition must stay tightly packed, it's uploaded as is");
+
+// Shader location of the feature class attribute, past raylib's default ones
+const int FEATURE_ATTRIB_LOCATION = 9;
+
+// Vertex formats a GpuMesh can hold
+enum class VertexLayout {
+  // PackedVertex
+  Packed,
+  // PackedPosition
+  PackedPosition,
+  // RoadVertex
+  Road,
+};
+
+// Part of a mesh's triangles, in indices. In vertices for meshes without indices
+struct IndexRange {
+  uint32_t first;
+  uint32_t count;
+};
+
+// Handles of a mesh living on the GPU, indices are 16 bits.
+// Its buffers come from the GpuBufferPool and can be larger than the mesh
+struct GpuMesh {
+  unsigned int vao = 0;
+  unsigned int vbo = 0;
+  unsigned int ebo = 0;
+  int index_count = 0;
+  int vertex_count = 0;
+  // bytes allocated for the buffers, and how many the mesh actually uses
+  int vertex_capacity = 0;
+  int index_capacity = 0;
+  int used_bytes = 0;
+  VertexLayout layout = VertexLayout::Packed;
+};
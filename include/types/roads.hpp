@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "raylib.h"
+#include "types/gpu_mesh.hpp"
+
+// Coarse grouping of the highway tag values, it decides how a road looks
+enum class RoadClass {Motorway, Primary, Secondary, Residential, Path};
+
+// Road ribbon vertex, the position is relative to the chunk's origin.
+// feature is the road's RoadClass, road.fs looks its colour up in a palette
+struct RoadVertex {
+  float position[3];
+  uint8_t feature;
+  uint8_t padding[3];
+};
+static_assert(sizeof(RoadVertex) == 16, "RoadVertex must stay tightly packed, it's uploaded as is");
+
+// A detail level of a chunk's roads, its own ribbons in a range of the RoadMesh's vertices
+struct RoadLod {
+  // how far the simplified centerlines can be from the actual ones, in world units. 0 at full detail
+  float tolerance;
+  IndexRange vertices;
+};
+
+// All the roads of a chunk as a single non indexed triangle list, every detail level one after the other
+struct RoadMesh {
+  // world position of the vertices' (0,0,0)
+  Vector2 origin;
+  std::vector<RoadVertex> vertices;
+  // from the full detail to the coarsest
+  std::vector<RoadLod> lods;
+  // world space
+  BoundingBox bounds;
+  GpuMesh gpu;
+
+  size_t cpu_bytes() const noexcept { return vertices.size()*sizeof(RoadVertex); }
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "raylib.h"
+#include "chunk.hpp"
+
+// Spreads the GPU uploads of finished chunks over several frames so that chunks arriving 
+// together don't stall a single frame. Chunks closest to the focus point are uploaded first
+class UploadQueue {
+public:
+  // an upload stops once either limit is reached, at least one mesh is uploaded per frame
+  struct Budget {
+    double max_ms;
+    size_t max_bytes;
+  };
+public:
+  explicit UploadQueue(Budget budget);
+
+  // the chunk's meshes must have been set, it is marked Generated once they are all uploaded unless it
+  // is still streaming. Pushing a chunk already pending does nothing, its new meshes are picked up
+  void push(std::shared_ptr<Chunk> chunk);
+  // uploads meshes within the frame budget
+  void process(Vector2 focus);
+  // drops the pending chunks, e.g. when they get unloaded
+  void clear();
+  // drops a single chunk, e.g. one streamed out before its upload was over
+  void remove(const std::shared_ptr<Chunk>& chunk);
+  size_t pending_chunks() const { return m.pending.size(); }
+private:
+  void update_stats() const;
+private:
+  struct M {
+    Budget budget;
+    std::vector<std::shared_ptr<Chunk>> pending = {};
+  } m;
+};
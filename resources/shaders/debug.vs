@@ -0,0 +1,17 @@
+#version 330
+
+// unit shape
+layout (location = 0) in vec3 vertexPosition;
+// per instance, see DebugOverlay::Instance
+layout (location = 10) in vec3 instanceCenter;
+layout (location = 11) in vec3 instanceScale;
+layout (location = 12) in vec4 instanceColor;
+
+uniform mat4 mvp;
+
+out vec4 fragColor;
+
+void main() {
+  fragColor = instanceColor;
+  gl_Position = mvp * vec4(instanceCenter + vertexPosition * instanceScale, 1.0);
+}
@@ -2,16 +2,23 @@
 
 in vec3 fragPosition;
 in vec3 fragNormal;
+flat in int fragFeature;
 
-uniform vec4 albedoColor;
+// colour of each BuildingClass, set from initialize_mat
+uniform vec4 palette[8];
 uniform vec3 viewPos;
+// set when meshes have no normal stream, the face normal is then derived from the position
+uniform int derivedNormals;
 
 out vec4 finalColor;
 
 void main() {
-    vec3 lightPos = vec3(0.0);
-    vec3 lightDir = normalize(lightPos - fragPosition);
-    float diffuseIntensity = max(0.0, dot(normalize(fragNormal), lightDir));
-    vec3 lightCol = vec3(1.0) * diffuseIntensity;
-    finalColor = vec4(normalize(fragNormal), 1.0);
+    vec3 normal = derivedNormals != 0
+        ? normalize(cross(dFdx(fragPosition), dFdy(fragPosition)))
+        : normalize(fragNormal);
+
+    vec3 lightDir = normalize(vec3(0.4, 1.0, 0.3));
+    float diffuseIntensity = max(0.0, dot(normal, lightDir));
+    vec4 albedo = palette[clamp(fragFeature, 0, 7)];
+    finalColor = vec4(albedo.rgb * (0.4 + 0.6 * diffuseIntensity), albedo.a);
 }
@@ -1,7 +1,11 @@
 #version 330
 
+// quantized position, the chunk's scale and origin are part of matModel
 layout (location = 0) in vec3 vertexPosition;
-layout (location = 2) in vec3 vertexNormal;
+// octahedral encoded normal
+layout (location = 2) in vec2 vertexNormal;
+// BuildingClass, an index in the fragment shader's palette
+layout (location = 9) in float vertexFeature;
 
 uniform mat4 matView;
 uniform mat4 matProjection;
@@ -10,10 +14,22 @@ uniform mat4 matNormal;
 
 out vec3 fragPosition;
 out vec3 fragNormal;
+flat out int fragFeature;
+
+vec2 signNotZero(vec2 v) {
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+  return normalize(n);
+}
 
 void main() {
   fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
-  fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
+  fragNormal = normalize(vec3(matNormal*vec4(octDecode(vertexNormal), 1.0)));
+  fragFeature = int(vertexFeature);
 
   gl_Position = matProjection * matView * matModel * vec4(vertexPosition, 1.0);
 }
@@ -0,0 +1,19 @@
+#version 330
+
+// position relative to the chunk origin, which is part of matModel
+layout (location = 0) in vec3 vertexPosition;
+// RoadClass, an index in the palette
+layout (location = 9) in float vertexFeature;
+
+uniform mat4 matView;
+uniform mat4 matProjection;
+uniform mat4 matModel;
+// colour of each RoadClass, set from initialize_road_mat
+uniform vec4 palette[8];
+
+out vec4 fragColor;
+
+void main() {
+  fragColor = palette[clamp(int(vertexFeature), 0, 7)];
+  gl_Position = matProjection * matView * matModel * vec4(vertexPosition, 1.0);
+}
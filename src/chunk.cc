@@ -1,10 +1,13 @@
 #include "chunk.hpp"
 #include "map_data.hpp"
 #include "earcut.hpp"
+#include "gpu_mesh.hpp"
+#include "stats.hpp"
 #include "raymath.h"
 #include "rlgl.h"
-#include <array>
 #include <vector>
+#include <cmath>
+#include <chrono>
 
 using namespace std;
 
@@ -12,73 +15,271 @@ Chunk::Chunk(double longA, double latA, double longB, double latB):
   min_lon(longA), min_lat(latA), max_lon(longB), max_lat(latB),
   world_min(to2DCoords(longA, latA)), world_max(to2DCoords(longB, latB)),
   m()
-{}
+{
+  update_bounds();
+}
+
+void Chunk::set_meshes(vector<ChunkMeshes>&& lods) {
+  release_meshes();
+  m.lods = std::move(lods);
+  m.uploaded_meshes.assign(m.lods.size(), 0);
+  for (const ChunkMeshes& lod : m.lods) {
+    for (const EarcutMesh& mesh : lod.meshes) 
+      stats().resident_mesh_bytes += mesh.cpu_bytes();
+  }
+  update_bounds();
+}
 
-void Chunk::upload_meshes(vector<EarcutMesh>&& in_meshes) {
-  m.meshes = std::move(in_meshes);
+void Chunk::add_meshes(vector<ChunkMeshes>&& lods) {
+  if (m.lods.empty()) {
+    set_meshes(std::move(lods));
+    return;
+  }
 
-  for (EarcutMesh& mesh : m.meshes) {
-    UploadMesh(&(mesh.mesh), false);
+  for (size_t lod = 0; lod < m.lods.size() && lod < lods.size(); ++lod) {
+    for (EarcutMesh& mesh : lods[lod].meshes) {
+      stats().resident_mesh_bytes += mesh.cpu_bytes();
+      m.lods[lod].meshes.push_back(std::move(mesh));
+    }
+    m.lods[lod].bounds.insert(m.lods[lod].bounds.end(), lods[lod].bounds.begin(), lods[lod].bounds.end());
+    // each part measured its own
+    m.lods[lod].geometric_error = max(m.lods[lod].geometric_error, lods[lod].geometric_error);
   }
+  update_bounds();
 }
 
-void Chunk::upload_roads(vector<Way>&& in_roads) {
-  m.roads = std::move(in_roads);
+static bool all_uploaded(const vector<ChunkMeshes>& lods, const vector<size_t>& uploaded) {
+  for (size_t lod = 0; lod < lods.size(); ++lod) {
+    if (uploaded[lod] < lods[lod].meshes.size()) return false;
+  }
+  return true;
 }
 
-void Chunk::unload() {
-  for (EarcutMesh& mesh : m.meshes) 
-    UnloadMesh(mesh.mesh);
-  m.meshes.clear();
-  m.roads.clear();
-  status = ChunkStatus::Pending;
+void Chunk::replace_meshes(vector<ChunkMeshes>&& lods) {
+  release_levels(m.replacement, m.replacement_uploaded);
+  vector<size_t> none(lods.size(), 0);
+  // nothing to keep drawn, or nothing to wait for
+  if (m.lods.empty() || all_uploaded(lods, none)) {
+    set_meshes(std::move(lods));
+    return;
+  }
+
+  m.replacement = std::move(lods);
+  m.replacement_uploaded = std::move(none);
+  for (const ChunkMeshes& lod : m.replacement) {
+    for (const EarcutMesh& mesh : lod.meshes) 
+      stats().resident_mesh_bytes += mesh.cpu_bytes();
+  }
 }
 
-array<shared_ptr<Chunk>, 8> Chunk::generate_adjacents() const {
-  Vector2 delta = Vector2Subtract(world_max, world_min);
+size_t Chunk::upload_next_mesh() {
+  size_t uploaded = upload_mesh();
+  if (uploaded > 0 && !m.shown) {
+    m.shown = true;
+    stats().first_geometry_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - downloaded_at).count();
+    ++stats().first_geometry_chunks;
+  }
+  return uploaded;
+}
+
+size_t Chunk::upload_mesh() {
+  if (m.road_mesh.gpu.vao == 0 && !m.road_mesh.vertices.empty()) {
+    m.road_mesh.gpu = upload_gpu_mesh(m.road_mesh.vertices);
+    size_t uploaded = m.road_mesh.cpu_bytes();
+    // roads are light, a compressed copy isn't worth it
+    if (retention == MeshRetention::Release) {
+      stats().resident_mesh_bytes -= uploaded;
+      m.road_mesh.vertices = {};
+    }
+    return uploaded;
+  }
+
+  if (m.replacement.empty()) return upload_level_mesh(m.lods, m.uploaded_meshes);
 
-  array<shared_ptr<Chunk>, 8> adjacents;
+  size_t uploaded = upload_level_mesh(m.replacement, m.replacement_uploaded);
+  // swapped at once, the chunk never shows a level half uploaded
+  if (all_uploaded(m.replacement, m.replacement_uploaded)) {
+    release_levels(m.lods, m.uploaded_meshes);
+    m.lods = std::move(m.replacement);
+    m.uploaded_meshes = std::move(m.replacement_uploaded);
+    m.replacement = {};
+    m.replacement_uploaded = {};
+    update_bounds();
+  }
+  return uploaded;
+}
 
-  double longA, latA, longB, latB;
-  // north
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x, world_min.y + delta.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x, world_max.y + delta.y}); 
-  adjacents.at(0) = make_shared<Chunk>(longA, latA, longB, latB);
+size_t Chunk::upload_level_mesh(vector<ChunkMeshes>& lods, vector<size_t>& uploaded_meshes) {
+  // the coarse levels are light and make the chunk visible from afar early
+  size_t lod = lods.size();
+  while (lod > 0 && uploaded_meshes[lod-1] == lods[lod-1].meshes.size()) --lod;
+  if (lod == 0) return 0;
+  --lod;
 
-  // north-east
-  tie(longA, latA) = toMapCoords(Vector2 {world_max.x, world_min.y + delta.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x + delta.x, world_max.y + delta.y}); 
-  adjacents.at(1) = make_shared<Chunk>(longA, latA, longB, latB);
+  EarcutMesh& mesh = lods[lod].meshes[uploaded_meshes[lod]++];
+  // back from release_gpu, the compressed copy is expanded for the upload
+  if (!mesh.compressed.empty()) {
+    stats().resident_mesh_bytes -= mesh.cpu_bytes();
+    decompress_mesh(mesh);
+    stats().resident_mesh_bytes += mesh.cpu_bytes();
+  }
+  if (lods[lod].mode == MeshMode::DerivedNormals)
+    mesh.gpu = upload_gpu_mesh(mesh.positions, mesh.indices);
+  else
+    mesh.gpu = upload_gpu_mesh(mesh.vertices, mesh.indices);
+  size_t uploaded = mesh.cpu_bytes();
 
-  // east
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x + delta.x, world_min.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x + delta.x, world_max.y}); 
-  adjacents.at(2) = make_shared<Chunk>(longA, latA, longB, latB);
+  stats().resident_mesh_bytes -= uploaded;
+  switch (retention) {
+    case MeshRetention::Release:
+    mesh.vertices = {};
+    mesh.positions = {};
+    mesh.indices = {};
+    break;
+    case MeshRetention::Compressed:
+    compress_mesh(mesh);
+    break;
+    case MeshRetention::Keep:
+    break;
+  }
+  stats().resident_mesh_bytes += mesh.cpu_bytes();
 
-  // south-east
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x + delta.x, world_min.y - delta.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x + delta.x, world_max.y - delta.y}); 
-  adjacents.at(3) = make_shared<Chunk>(longA, latA, longB, latB);
+  return uploaded;
+}
 
-  // south
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x, world_min.y - delta.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x, world_max.y - delta.y}); 
-  adjacents.at(4) = make_shared<Chunk>(longA, latA, longB, latB);
+bool Chunk::materialize_meshes() {
+  if (retention == MeshRetention::Release) return false;
 
-  // south-west
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x - delta.x, world_min.y - delta.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x - delta.x, world_max.y - delta.y}); 
-  adjacents.at(5) = make_shared<Chunk>(longA, latA, longB, latB);
+  for (size_t lod = 0; lod < m.lods.size(); ++lod) {
+    for (size_t i = 0; i < m.uploaded_meshes[lod]; ++i) {
+      EarcutMesh& mesh = m.lods[lod].meshes[i];
+      stats().resident_mesh_bytes -= mesh.cpu_bytes();
+      decompress_mesh(mesh);
+      stats().resident_mesh_bytes += mesh.cpu_bytes();
+    }
+  }
+  return true;
+}
 
-  // west
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x - delta.x, world_min.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x - delta.x, world_max.y}); 
-  adjacents.at(6) = make_shared<Chunk>(longA, latA, longB, latB);
+bool Chunk::release_gpu() {
+  if (retention == MeshRetention::Release) return false;
 
-  // north-west
-  tie(longA, latA) = toMapCoords(Vector2 {world_min.x - delta.x, world_min.y + delta.y}); 
-  tie(longB, latB) = toMapCoords(Vector2 {world_max.x - delta.x, world_max.y + delta.y}); 
-  adjacents.at(7) = make_shared<Chunk>(longA, latA, longB, latB);
+  for (size_t lod = 0; lod < m.lods.size(); ++lod) {
+    for (size_t i = 0; i < m.uploaded_meshes[lod]; ++i) 
+      unload_gpu_mesh(m.lods[lod].meshes[i].gpu);
+    m.uploaded_meshes[lod] = 0;
+  }
+  for (size_t lod = 0; lod < m.replacement.size(); ++lod) {
+    for (size_t i = 0; i < m.replacement_uploaded[lod]; ++i) 
+      unload_gpu_mesh(m.replacement[lod].meshes[i].gpu);
+    m.replacement_uploaded[lod] = 0;
+  }
+  unload_gpu_mesh(m.road_mesh.gpu);
+  return true;
+}
 
-  return adjacents;
+size_t Chunk::cpu_bytes() const {
+  size_t bytes = m.road_mesh.cpu_bytes();
+  for (const auto* levels : {&m.lods, &m.replacement}) {
+    for (const ChunkMeshes& lod : *levels) {
+      for (const EarcutMesh& mesh : lod.meshes) bytes += mesh.cpu_bytes();
+    }
+  }
+  return bytes;
+}
+
+size_t Chunk::gpu_bytes() const {
+  size_t bytes = m.road_mesh.gpu.used_bytes;
+  for (size_t lod = 0; lod < m.lods.size(); ++lod) {
+    for (size_t i = 0; i < m.uploaded_meshes[lod]; ++i) bytes += m.lods[lod].meshes[i].gpu.used_bytes;
+  }
+  for (size_t lod = 0; lod < m.replacement.size(); ++lod) {
+    for (size_t i = 0; i < m.replacement_uploaded[lod]; ++i) bytes += m.replacement[lod].meshes[i].gpu.used_bytes;
+  }
+  return bytes;
+}
+
+void Chunk::release_levels(vector<ChunkMeshes>& lods, vector<size_t>& uploaded) {
+  for (size_t lod = 0; lod < lods.size(); ++lod) {
+    for (size_t i = 0; i < lods[lod].meshes.size(); ++i) {
+      EarcutMesh& mesh = lods[lod].meshes[i];
+      if (i < uploaded[lod]) unload_gpu_mesh(mesh.gpu);
+      stats().resident_mesh_bytes -= mesh.cpu_bytes();
+    }
+  }
+  lods = {};
+  uploaded = {};
+}
+
+void Chunk::release_meshes() {
+  release_levels(m.lods, m.uploaded_meshes);
+  release_levels(m.replacement, m.replacement_uploaded);
+}
+
+void Chunk::release_road_mesh() {
+  unload_gpu_mesh(m.road_mesh.gpu);
+  stats().resident_mesh_bytes -= m.road_mesh.cpu_bytes();
+  m.road_mesh = {};
+}
+
+size_t Chunk::pending_upload_bytes() const {
+  size_t bytes = m.road_mesh.gpu.vao == 0 ? m.road_mesh.cpu_bytes() : 0;
+  for (size_t lod = 0; lod < m.lods.size(); ++lod) {
+    for (size_t i = m.uploaded_meshes[lod]; i < m.lods[lod].meshes.size(); ++i) 
+      bytes += m.lods[lod].meshes[i].cpu_bytes();
+  }
+  for (size_t lod = 0; lod < m.replacement.size(); ++lod) {
+    for (size_t i = m.replacement_uploaded[lod]; i < m.replacement[lod].meshes.size(); ++i) 
+      bytes += m.replacement[lod].meshes[i].cpu_bytes();
+  }
+  return bytes;
+}
+
+span<const EarcutMesh> Chunk::meshes(size_t lod) const {
+  if (lod >= m.lods.size()) return {};
+  return span(m.lods[lod].meshes).first(m.uploaded_meshes[lod]);
+}
+
+span<const BoundingBox> Chunk::meshes_bounds(size_t lod) const {
+  if (lod >= m.lods.size()) return {};
+  return span(m.lods[lod].bounds).first(m.uploaded_meshes[lod]);
+}
+
+Matrix Chunk::meshes_transform(size_t lod) const {
+  float scale = m.lods[lod].position_scale;
+  return MatrixMultiply(MatrixScale(scale, scale, scale), MatrixTranslate(m.lods[lod].origin.x, 0.f, m.lods[lod].origin.y));
+}
+
+Matrix Chunk::roads_transform() const {
+  return MatrixTranslate(m.road_mesh.origin.x, 0.f, m.road_mesh.origin.y);
+}
+
+void Chunk::set_roads(RoadMesh&& in_mesh, size_t road_count) {
+  release_road_mesh();
+  m.road_count = road_count;
+  m.road_mesh = std::move(in_mesh);
+  stats().resident_mesh_bytes += m.road_mesh.cpu_bytes();
+  update_bounds();
+}
+
+void Chunk::update_bounds() {
+  m.bounds = BoundingBox {Vector3 {INFINITY, INFINITY, INFINITY}, Vector3 {-INFINITY, -INFINITY, -INFINITY}};
+  auto extend = [this](const BoundingBox& box) {
+    m.bounds.min = Vector3Min(m.bounds.min, box.min);
+    m.bounds.max = Vector3Max(m.bounds.max, box.max);
+  };
+  for (const ChunkMeshes& lod : m.lods) {
+    for (const BoundingBox& box : lod.bounds) extend(box);
+  }
+  if (!m.road_mesh.vertices.empty() || m.road_mesh.gpu.vertex_count > 0) extend(m.road_mesh.bounds);
+}
+
+void Chunk::unload() {
+  release_meshes();
+  release_road_mesh();
+  m.road_count = 0;
+  update_bounds();
+  m.shown = false;
+  streaming = false;
+  status = ChunkStatus::Pending;
 }
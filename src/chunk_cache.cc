@@ -0,0 +1,73 @@
+#include "chunk_cache.hpp"
+#include <algorithm>
+
+using namespace std;
+
+ChunkCache::ChunkCache(Budget budget):
+  m {.budget = budget}
+{}
+
+void ChunkCache::put(Cell cell, shared_ptr<Chunk> chunk) {
+  m.entries.push_back(Entry {cell, std::move(chunk)});
+  m.usage.chunks = m.entries.size();
+}
+
+shared_ptr<Chunk> ChunkCache::take(Cell cell) {
+  auto entry = ranges::find(m.entries, cell, &Entry::cell);
+  if (entry == m.entries.end()) {
+    ++m.usage.misses;
+    return nullptr;
+  }
+
+  shared_ptr<Chunk> chunk = std::move(entry->chunk);
+  m.entries.erase(entry);
+  m.usage.chunks = m.entries.size();
+  ++m.usage.hits;
+  return chunk;
+}
+
+void ChunkCache::trim(span<const shared_ptr<Chunk>> loaded) {
+  size_t cpu = 0, gpu = 0;
+  for (const shared_ptr<Chunk>& chunk : loaded) {
+    cpu += chunk->cpu_bytes();
+    gpu += chunk->gpu_bytes();
+  }
+  for (const Entry& entry : m.entries) {
+    cpu += entry.chunk->cpu_bytes();
+    gpu += entry.chunk->gpu_bytes();
+  }
+
+  auto evict = [&](list<Entry>::iterator entry) {
+    cpu -= entry->chunk->cpu_bytes();
+    gpu -= entry->chunk->gpu_bytes();
+    entry->chunk->unload();
+    ++m.usage.evictions;
+    return m.entries.erase(entry);
+  };
+
+  // GPU copies first, a chunk that keeps its CPU copy only has to be uploaded again
+  for (auto entry = m.entries.begin(); entry != m.entries.end() && gpu > m.budget.gpu_bytes;) {
+    size_t bytes = entry->chunk->gpu_bytes();
+    if (bytes > 0 && entry->chunk->release_gpu()) {
+      gpu -= bytes;
+      ++entry;
+    } else if (bytes > 0) {
+      entry = evict(entry);
+    } else {
+      ++entry;
+    }
+  }
+  for (auto entry = m.entries.begin(); entry != m.entries.end() && cpu > m.budget.cpu_bytes;)
+    entry = evict(entry);
+
+  m.usage.cpu_bytes = cpu;
+  m.usage.gpu_bytes = gpu;
+  m.usage.chunks = m.entries.size();
+}
+
+void ChunkCache::clear() {
+  for (Entry& entry : m.entries)
+    entry.chunk->unload();
+  m.entries.clear();
+  m.usage.chunks = 0;
+}
@@ -0,0 +1,114 @@
+#include "chunk_streamer.hpp"
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include "map_data.hpp"
+#include "raymath.h"
+
+using namespace std;
+
+ChunkStreamer::ChunkStreamer(shared_ptr<Chunk> start_chunk, Config config):
+  m {
+    .config = config,
+    .grid_origin = start_chunk->world_min,
+    .cell_size = Vector2Subtract(start_chunk->world_max, start_chunk->world_min),
+    .retention = start_chunk->retention,
+  }
+{
+  m.cells[{0, 0}] = start_chunk;
+  m.chunks.push_back(std::move(start_chunk));
+}
+
+shared_ptr<Chunk> ChunkStreamer::make_chunk(int x, int z) const {
+  Vector2 world_min = Vector2Add(m.grid_origin, Vector2 {x * m.cell_size.x, z * m.cell_size.y});
+  auto [longA, latA] = toMapCoords(world_min);
+  auto [longB, latB] = toMapCoords(Vector2Add(world_min, m.cell_size));
+  shared_ptr<Chunk> chunk = make_shared<Chunk>(longA, latA, longB, latB);
+  chunk->retention = m.retention;
+  return chunk;
+}
+
+float ChunkStreamer::distance_to_cell(Vector2 p, int x, int z) const {
+  Vector2 a = Vector2Add(m.grid_origin, Vector2 {x * m.cell_size.x, z * m.cell_size.y});
+  Vector2 b = Vector2Add(a, m.cell_size);
+  float dx = max({min(a.x, b.x) - p.x, 0.f, p.x - max(a.x, b.x)});
+  float dz = max({min(a.y, b.y) - p.y, 0.f, p.y - max(a.y, b.y)});
+  return sqrtf(dx*dx + dz*dz);
+}
+
+void ChunkStreamer::update(Vector3 camera_position, Vector3 camera_target, MapBuildJob& build_job, UploadQueue& upload_queue, 
+  ChunkCache& cache) {
+  Vector2 position {camera_position.x, camera_position.z};
+  Vector2 forward = Vector2Normalize(Vector2 {camera_target.x - camera_position.x, camera_target.z - camera_position.z});
+  bool changed = false;
+
+  // retired first, their requests make room for the new chunks
+  for (auto it = m.cells.begin(); it != m.cells.end();) {
+    auto [x, z] = it->first;
+    if (distance_to_cell(position, x, z) <= m.config.unload_radius) {
+      ++it;
+      continue;
+    }
+    const shared_ptr<Chunk>& chunk = it->second;
+    upload_queue.remove(chunk);
+    // unfinished chunks start over when they come back
+    if (chunk->status == ChunkStatus::Generated) {
+      cache.put(it->first, chunk);
+    } else {
+      build_job.cancel(chunk);
+      chunk->unload();
+    }
+    ++m.counters.retired;
+    it = m.cells.erase(it);
+    changed = true;
+  }
+
+  // cells overlapping the load radius, around the camera's cell
+  int camera_x = (int)floorf((position.x - m.grid_origin.x) / m.cell_size.x);
+  int camera_z = (int)floorf((position.y - m.grid_origin.y) / m.cell_size.y);
+  int reach_x = (int)ceilf(m.config.load_radius / fabsf(m.cell_size.x));
+  int reach_z = (int)ceilf(m.config.load_radius / fabsf(m.cell_size.y));
+  for (int z = camera_z - reach_z; z <= camera_z + reach_z; ++z) {
+    for (int x = camera_x - reach_x; x <= camera_x + reach_x; ++x) {
+      if (m.cells.contains({x, z}) || distance_to_cell(position, x, z) > m.config.load_radius) continue;
+      shared_ptr<Chunk> chunk = cache.take({x, z});
+      if (chunk == nullptr) {
+        chunk = make_chunk(x, z);
+      } else if (chunk->pending_upload_bytes() > 0) {
+        // its GPU copy was dropped while it was cached
+        upload_queue.push(chunk);
+      }
+      m.cells[{x, z}] = std::move(chunk);
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    m.chunks.clear();
+    for (const auto& [cell, chunk] : m.cells) m.chunks.push_back(chunk);
+  }
+  cache.trim(m.chunks);
+
+  // retired chunks still being built hold the builder too
+  size_t in_flight = build_job.requests_in_flight();
+  if (in_flight >= m.config.max_requests) return;
+
+  // chunks ahead of the camera count as up to twice closer than those behind it
+  auto priority = [&](const shared_ptr<Chunk>& chunk) {
+    Vector2 center = Vector2Scale(Vector2Add(chunk->world_min, chunk->world_max), .5f);
+    Vector2 to_chunk = Vector2Subtract(center, position);
+    float distance = Vector2Length(to_chunk);
+    float facing = distance > 0.f ? Vector2DotProduct(Vector2Scale(to_chunk, 1.f / distance), forward) : 1.f;
+    return distance * (1.5f - .5f * facing);
+  };
+  // failed chunks wait for their retry time
+  auto now = chrono::steady_clock::now();
+  vector<shared_ptr<Chunk>> pending;
+  for (const shared_ptr<Chunk>& chunk : m.chunks) {
+    if (chunk->status == ChunkStatus::Pending && chunk->retry_at <= now) pending.push_back(chunk);
+  }
+  ranges::sort(pending, {}, priority);
+  pending.resize(min(pending.size(), m.config.max_requests - in_flight));
+  m.counters.requested += pending.size();
+  build_job.start(pending);
+}
@@ -0,0 +1,158 @@
+#include "debug_overlay.hpp"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstddef>
+#include "rlgl.h"
+#include "raymath.h"
+
+using namespace std;
+
+// Per instance attributes of debug.vs, past the ones the chunk meshes use
+static const int INSTANCE_CENTER_LOCATION = 10;
+static const int INSTANCE_SCALE_LOCATION = 11;
+static const int INSTANCE_COLOR_LOCATION = 12;
+
+// markers are small on screen, DrawSphere's 16 x 16 would be wasted on them
+static const int SPHERE_RINGS = 8;
+static const int SPHERE_SLICES = 12;
+
+void DebugOverlay::load() {
+  m.shader = LoadShader("resources/shaders/debug.vs", "resources/shaders/debug.fs");
+  m.mvp_location = GetShaderLocation(m.shader, "mvp");
+
+  // unit sphere, counter clockwise seen from outside
+  vector<Vector3> positions;
+  vector<uint16_t> indices;
+  for (int ring = 0; ring <= SPHERE_RINGS; ++ring) {
+    float phi = PI * ring / SPHERE_RINGS;
+    for (int slice = 0; slice <= SPHERE_SLICES; ++slice) {
+      float theta = 2.f * PI * slice / SPHERE_SLICES;
+      positions.push_back(Vector3 {sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta)});
+    }
+  }
+  for (int ring = 0; ring < SPHERE_RINGS; ++ring) {
+    for (int slice = 0; slice < SPHERE_SLICES; ++slice) {
+      uint16_t a = ring * (SPHERE_SLICES + 1) + slice, b = a + SPHERE_SLICES + 1;
+      indices.insert(indices.end(), {a, (uint16_t)(a + 1), b, (uint16_t)(a + 1), (uint16_t)(b + 1), b});
+    }
+  }
+  m.sphere = load_shape(positions, indices);
+
+  // unit quad facing up
+  m.plane = load_shape(
+    {{-.5f, 0.f, -.5f}, {-.5f, 0.f, .5f}, {.5f, 0.f, .5f}, {.5f, 0.f, -.5f}},
+    {0, 1, 2, 0, 2, 3}
+  );
+}
+
+void DebugOverlay::unload() {
+  unload_shape(m.sphere);
+  unload_shape(m.plane);
+  UnloadShader(m.shader);
+  m.shader = Shader {};
+}
+
+DebugOverlay::Shape DebugOverlay::load_shape(const vector<Vector3>& positions, const vector<uint16_t>& indices) {
+  Shape shape {};
+  shape.index_count = indices.size();
+  shape.vao = rlLoadVertexArray();
+  rlEnableVertexArray(shape.vao);
+  shape.vbo = rlLoadVertexBuffer(positions.data(), positions.size() * sizeof(Vector3), false);
+  rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 3, RL_FLOAT, false, sizeof(Vector3), 0);
+  rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
+  shape.ebo = rlLoadVertexBufferElement(indices.data(), indices.size() * sizeof(uint16_t), false);
+  rlDisableVertexArray();
+  return shape;
+}
+
+void DebugOverlay::unload_shape(Shape& shape) {
+  if (shape.vao == 0) return;
+  rlUnloadVertexArray(shape.vao);
+  rlUnloadVertexBuffer(shape.vbo);
+  rlUnloadVertexBuffer(shape.ebo);
+  if (shape.instance_vbo != 0) rlUnloadVertexBuffer(shape.instance_vbo);
+  shape = Shape {};
+}
+
+void DebugOverlay::upload_instances(Shape& shape) {
+  size_t bytes = shape.instances.size() * sizeof(Instance);
+  if (shape.instances.size() <= shape.instance_capacity) {
+    rlUpdateVertexBuffer(shape.instance_vbo, shape.instances.data(), bytes, 0);
+    return;
+  }
+
+  // doubled so that a growing number of chunks doesn't reallocate every frame
+  if (shape.instance_vbo != 0) rlUnloadVertexBuffer(shape.instance_vbo);
+  shape.instance_capacity = max<size_t>(64, 2 * shape.instances.size());
+  rlEnableVertexArray(shape.vao);
+  shape.instance_vbo = rlLoadVertexBuffer(nullptr, shape.instance_capacity * sizeof(Instance), true);
+  rlUpdateVertexBuffer(shape.instance_vbo, shape.instances.data(), bytes, 0);
+  rlSetVertexAttribute(INSTANCE_CENTER_LOCATION, 3, RL_FLOAT, false, sizeof(Instance), offsetof(Instance, center));
+  rlSetVertexAttribute(INSTANCE_SCALE_LOCATION, 3, RL_FLOAT, false, sizeof(Instance), offsetof(Instance, scale));
+  rlSetVertexAttribute(INSTANCE_COLOR_LOCATION, 4, RL_UNSIGNED_BYTE, true, sizeof(Instance), offsetof(Instance, color));
+  for (int location : {INSTANCE_CENTER_LOCATION, INSTANCE_SCALE_LOCATION, INSTANCE_COLOR_LOCATION}) {
+    rlEnableVertexAttribute(location);
+    rlSetVertexAttributeDivisor(location, 1);
+  }
+  rlDisableVertexArray();
+}
+
+void DebugOverlay::sort_instances(Shape& shape, Vector3 camera) {
+  auto distance = [camera](const Instance& instance) {
+    return Vector3Distance(Vector3 {instance.center[0], instance.center[1], instance.center[2]}, camera);
+  };
+  // shared corners are at the same distance, the order they were added in keeps them from flickering
+  ranges::stable_sort(shape.instances, greater {}, distance);
+}
+
+void DebugOverlay::add_sphere(Vector3 center, float radius, Color color) {
+  if (!m.enabled) return;
+  m.sphere.instances.push_back(Instance {
+    .center = {center.x, center.y, center.z},
+    .scale = {radius, radius, radius},
+    .color = {color.r, color.g, color.b, color.a},
+  });
+}
+
+void DebugOverlay::add_plane(Vector3 center, Vector2 size, Color color) {
+  if (!m.enabled) return;
+  m.plane.instances.push_back(Instance {
+    .center = {center.x, center.y, center.z},
+    .scale = {size.x, 1.f, size.y},
+    .color = {color.r, color.g, color.b, color.a},
+  });
+}
+
+void DebugOverlay::draw(Vector3 camera) {
+  auto start = chrono::steady_clock::now();
+  m.counters = Counters {};
+  if (!m.enabled || m.shader.id == 0) {
+    m.sphere.instances.clear();
+    m.plane.instances.clear();
+    return;
+  }
+
+  // anything left in rlgl's batch belongs before the overlay
+  rlDrawRenderBatchActive();
+  rlEnableShader(m.shader.id);
+  rlSetUniformMatrix(m.mvp_location, MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+  rlDisableDepthMask();
+  // planes lie under the markers
+  for (Shape* shape : {&m.plane, &m.sphere}) {
+    if (shape->instances.empty()) continue;
+    sort_instances(*shape, camera);
+    upload_instances(*shape);
+    rlEnableVertexArray(shape->vao);
+    rlDrawVertexArrayElementsInstanced(0, shape->index_count, 0, shape->instances.size());
+    rlDisableVertexArray();
+    m.counters.instances += shape->instances.size();
+    ++m.counters.draw_calls;
+    shape->instances.clear();
+  }
+  rlEnableDepthMask();
+  rlDisableShader();
+
+  chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+  m.counters.cpu_ms = elapsed.count();
+}
@@ -5,173 +5,487 @@
 #include <ranges>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <numeric>
+#include <span>
+#include <future>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <array>
+#include <optional>
+#include <string_view>
+#include <initializer_list>
 #include "map_data.hpp"
+#include "stats.hpp"
+#include "gpu_mesh.hpp"
+#include "simd.hpp"
 #include "raylib.h"
 #include "raymath.h"
 
 using namespace std;
 namespace views = ranges::views;
 
-EarcutResult earcut_single(const Way& w) {
-  assert(w.nodes.size() >= 3 && "Unimplemented: handle case when building has less than 3 nodes (weird)");
-  const size_t LIST_NODES_BUFFER_SZ = 64;
-  const float BUILDING_ELEVATION = 0.5f;
-  struct ListNode {
-    Vector2 data;
-    bool is_convex;
-    ListNode* nx;
-    ListNode* pv;
+// Ear validation, turn computations and mesh assembly go through 4-wide vector kernels (see simd.hpp).
+// Vector and scalar kernels must round the same way, no fused multiply-add
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+enum class RoofShape {Quad, Convex, Concave};
+
+// turn at vertex vi, the sign tells whether the vertex is convex given the ring winding
+static inline float turn_cross(Vector2 vp, Vector2 vi, Vector2 vn) {
+  Vector2 a = Vector2Subtract(vp, vi), b = Vector2Subtract(vn, vi);
+  return a.x * b.y - a.y * b.x;
+}
+
+static inline bool is_convex_turn(float cross, bool winding_clockwise) {
+  return (winding_clockwise && cross < 0) || (!winding_clockwise && cross > 0);
+}
+
+// O(n) classification of a ring. Most buildings are rectangles or near-convex polygons 
+// that don't need to go through the ear clipping loop.
+// Collinear vertices are tolerated, they only produce flat triangles in the fan
+static RoofShape classify_ring(const Vector2* ring, const float* turns, size_t n, bool winding_clockwise) {
+  // every turn must have the same sign ...
+  for (size_t i = 0; i < n; ++i) {
+    if (turns[i] != 0.f && !is_convex_turn(turns[i], winding_clockwise)) return RoofShape::Concave;
+  }
+
+  // 4 turns of the same sign can't wrap around more than once, no need to check further
+  if (n == 4) return RoofShape::Quad;
+
+  // ... and the ring must not loop over itself (star shapes), in which case 
+  // the x and y directions would flip more than twice
+  auto count_flips = [&](auto coord) {
+    int flips = 0;
+    float prev_sign = 0.f;
+    for (size_t i = 0; i < n; ++i) {
+      float d = coord(ring[(i+1)%n]) - coord(ring[i]);
+      if (d == 0.f) continue;
+      float sign = d > 0.f ? 1.f : -1.f;
+      if (prev_sign != 0.f && sign != prev_sign) ++flips;
+      prev_sign = sign;
+    }
+    return flips;
   };
+  if (count_flips([](Vector2 v){ return v.x; }) > 2 || count_flips([](Vector2 v){ return v.y; }) > 2) 
+    return RoofShape::Concave;
 
-  // We are not inverting origin.y to keep the world_transform consistent in the return value,
-  // we do need to invert it when generating 2D coordinates below
-  Vector2 origin = to2DCoords(w.nodes[0].longitude, w.nodes[0].latitude);
+  return RoofShape::Convex;
+}
 
-  // simply transform node coordinates into Vector2s w/ origin being the first node's coordinates
-  auto verts_range = w.nodes 
-    | views::take(w.nodes.size()-1)  // skip last node as it's == to the first one
-    | views::transform([&origin](const Node& n) -> Vector2 { 
-      Vector2 v = Vector2Subtract(to2DCoords(n.longitude, n.latitude), origin);
-      return v; 
-    });
+// Boundary inclusive, unlike raylib's CheckCollisionPointTriangle: a reflex vertex lying on the 
+// diagonal of a candidate ear also invalidates it, otherwise the ear would overlap the notch behind it
+static inline bool point_in_triangle(Vector2 p, Vector2 a, Vector2 b, Vector2 c) {
+  float d1 = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+  float d2 = (c.x - b.x) * (p.y - b.y) - (c.y - b.y) * (p.x - b.x);
+  float d3 = (a.x - c.x) * (p.y - c.y) - (a.y - c.y) * (p.x - c.x);
+  bool has_neg = d1 < 0 || d2 < 0 || d3 < 0;
+  bool has_pos = d1 > 0 || d2 > 0 || d3 > 0;
+  return !(has_neg && has_pos);
+}
 
-  // storing vertices data as a doubly linked list
-  ListNode vertices_buffer[LIST_NODES_BUFFER_SZ];
-  size_t idx = 0;
-  for (auto it = verts_range.begin(); it != verts_range.end(); ++it) {
-    assert(idx < LIST_NODES_BUFFER_SZ-1 && "The vertices ListNode array is too small");
-    vertices_buffer[idx].data = *it;
-    vertices_buffer[idx].is_convex = false;
+static inline bool same_point(Vector2 a, Vector2 b) {
+  return a.x == b.x && a.y == b.y;
+}
+
+// Cross product of every turn of the ring. xs and ys hold the ring wrapped with one extra 
+// vertex on each side: v(n-1), v0, ..., v(n-1), v0
+static void compute_turns(const float* xs, const float* ys, size_t n, float* turns) {
+  size_t i = 0;
+#ifdef HAS_SIMD
+  for (; i + 4 <= n; i += 4) {
+    f32x4 xi = load4(xs+i+1), yi = load4(ys+i+1);
+    f32x4 ax = load4(xs+i) - xi, ay = load4(ys+i) - yi;
+    f32x4 bx = load4(xs+i+2) - xi, by = load4(ys+i+2) - yi;
+    store4(turns+i, ax * by - ay * bx);
+  }
+#endif
+  for (; i < n; ++i) {
+    turns[i] = turn_cross(Vector2 {xs[i], ys[i]}, Vector2 {xs[i+1], ys[i+1]}, Vector2 {xs[i+2], ys[i+2]});
+  }
+}
+
+// Whether any of the points is inside the ear (vp, vi, vn). Copies of vp and vn are ignored:
+// rings touching themselves may hold the ear's corners twice
+static bool any_point_in_ear(const float* xs, const float* ys, size_t n, Vector2 vp, Vector2 vi, Vector2 vn) {
+  size_t i = 0;
+#ifdef HAS_SIMD
+  // same operations as point_in_triangle(p, vi, vp, vn), lane wise
+  const f32x4 zero = splat4(0.f);
+  const f32x4 ax = splat4(vi.x), ay = splat4(vi.y);
+  const f32x4 bx = splat4(vp.x), by = splat4(vp.y);
+  const f32x4 cx = splat4(vn.x), cy = splat4(vn.y);
+  const f32x4 bax = splat4(vp.x - vi.x), bay = splat4(vp.y - vi.y);
+  const f32x4 cbx = splat4(vn.x - vp.x), cby = splat4(vn.y - vp.y);
+  const f32x4 acx = splat4(vi.x - vn.x), acy = splat4(vi.y - vn.y);
+  for (; i + 4 <= n; i += 4) {
+    f32x4 px = load4(xs+i), py = load4(ys+i);
+    f32x4 d1 = bax * (py - ay) - bay * (px - ax);
+    f32x4 d2 = cbx * (py - by) - cby * (px - bx);
+    f32x4 d3 = acx * (py - cy) - acy * (px - cx);
+    i32x4 has_neg = (d1 < zero) | (d2 < zero) | (d3 < zero);
+    i32x4 has_pos = (d1 > zero) | (d2 > zero) | (d3 > zero);
+    i32x4 is_corner = ((px == bx) & (py == by)) | ((px == cx) & (py == cy));
+    if (any4(~(has_neg & has_pos) & ~is_corner)) return true;
+  }
+#endif
+  for (; i < n; ++i) {
+    Vector2 p {xs[i], ys[i]};
+    if (!same_point(p, vp) && !same_point(p, vn) && point_in_triangle(p, vi, vp, vn)) return true;
+  }
+  return false;
+}
+
+// |cross| relative to the edge lengths under which 3 vertices are considered collinear
+static const float COLLINEAR_EPSILON = 1e-5f;
+// height of every building, OSM rarely has the real one
+static const float BUILDING_ELEVATION = 0.5f;
+
+static inline bool is_collinear(Vector2 vp, Vector2 vi, Vector2 vn) {
+  Vector2 a = Vector2Subtract(vp, vi), b = Vector2Subtract(vn, vi);
+  return fabsf(a.x * b.y - a.y * b.x) <= COLLINEAR_EPSILON * Vector2Length(a) * Vector2Length(b);
+}
+
+// Drops duplicate and collinear vertices in a single pass, duplicates being collinear by definition.
+// This also gets rid of the closing node and of spikes going back and forth on the same line
+static void clean_ring(vector<Vector2>& ring) {
+  size_t n = 0;
+  for (size_t i = 0; i < ring.size(); ++i) {
+    while (n >= 2 && is_collinear(ring[n-2], ring[n-1], ring[i])) --n;
+    if (n == 1 && same_point(ring[0], ring[i])) continue;
+    ring[n++] = ring[i];
+  }
 
-    if (idx > 0) {
-      vertices_buffer[idx].pv = &vertices_buffer[idx-1];
-      vertices_buffer[idx-1].nx = &vertices_buffer[idx];
+  // the ring wraps around so the junction must be checked as well
+  size_t first = 0;
+  while (n - first >= 3) {
+    if (is_collinear(ring[n-2], ring[n-1], ring[first])) --n;
+    else if (is_collinear(ring[n-1], ring[first], ring[first+1])) ++first;
+    else break;
+  }
+
+  if (n - first < 3) {
+    ring.clear();
+    return;
+  }
+
+  ring.erase(ring.begin() + n, ring.end());
+  ring.erase(ring.begin(), ring.begin() + first);
+}
+
+// Andrew's monotone chain, O(n log n). Returns indices into the ring, the hull has a positive signed area
+static vector<uint32_t> convex_hull(const vector<Vector2>& ring) {
+  vector<uint32_t> pts(ring.size());
+  for (uint32_t i = 0; i < pts.size(); ++i) pts[i] = i;
+  ranges::sort(pts, [&ring](uint32_t a, uint32_t b) { 
+    return ring[a].x < ring[b].x || (ring[a].x == ring[b].x && ring[a].y < ring[b].y); 
+  });
+  auto cross = [&ring](uint32_t o, uint32_t a, uint32_t b) { 
+    return (ring[a].x - ring[o].x) * (ring[b].y - ring[o].y) - (ring[a].y - ring[o].y) * (ring[b].x - ring[o].x); 
+  };
+
+  vector<uint32_t> hull(2 * pts.size());
+  size_t k = 0;
+  for (size_t i = 0; i < pts.size(); ++i) {
+    while (k >= 2 && cross(hull[k-2], hull[k-1], pts[i]) <= 0) --k;
+    hull[k++] = pts[i];
+  }
+  for (size_t i = pts.size() - 1, t = k + 1; i > 0; --i) {
+    while (k >= t && cross(hull[k-2], hull[k-1], pts[i-1]) <= 0) --k;
+    hull[k++] = pts[i-1];
+  }
+
+  hull.resize(k - 1);
+  return hull;
+}
+
+// Whether the segment ab crosses the box [lo, hi], touching counts (Liang-Barsky clipping)
+static bool segment_hits_box(Vector2 a, Vector2 b, Vector2 lo, Vector2 hi) {
+  float t0 = 0.f, t1 = 1.f;
+  const float d[2] = {b.x - a.x, b.y - a.y};
+  const float p[2] = {a.x, a.y};
+  const float box_lo[2] = {lo.x, lo.y}, box_hi[2] = {hi.x, hi.y};
+  for (int axis = 0; axis < 2; ++axis) {
+    if (d[axis] == 0.f) {
+      if (p[axis] < box_lo[axis] || p[axis] > box_hi[axis]) return false;
+      continue;
+    }
+    float ta = (box_lo[axis] - p[axis]) / d[axis];
+    float tb = (box_hi[axis] - p[axis]) / d[axis];
+    t0 = max(t0, min(ta, tb));
+    t1 = min(t1, max(ta, tb));
+    if (t0 > t1) return false;
+  }
+  return true;
+}
+
+static bool point_in_ring(span<const Vector2> ring, Vector2 p) {
+  bool inside = false;
+  for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+    const Vector2& a = ring[i];
+    const Vector2& b = ring[j];
+    if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x) inside = !inside;
+  }
+  return inside;
+}
+
+// Axis aligned box inside the footprint, for occlusion culling. The footprint's bounds are shrunk around their 
+// center, then around the vertices' average, until no edge crosses them. Empty when neither works out
+static BoundingBox occluder_box(const vector<Vector2>& ring, float elevation) {
+  Vector2 lo {INFINITY, INFINITY}, hi {-INFINITY, -INFINITY}, average {0.f, 0.f};
+  for (const Vector2& v : ring) {
+    lo = Vector2 {min(lo.x, v.x), min(lo.y, v.y)};
+    hi = Vector2 {max(hi.x, v.x), max(hi.y, v.y)};
+    average = Vector2Add(average, v);
+  }
+  average = Vector2Scale(average, 1.f / ring.size());
+  Vector2 half_size = Vector2Scale(Vector2Subtract(hi, lo), .5f);
+
+  for (Vector2 center : {Vector2Scale(Vector2Add(lo, hi), .5f), average}) {
+    if (!point_in_ring(ring, center)) continue;
+    for (float shrink : {.9f, .7f, .5f, .35f, .25f}) {
+      Vector2 box_lo = Vector2Subtract(center, Vector2Scale(half_size, shrink));
+      Vector2 box_hi = Vector2Add(center, Vector2Scale(half_size, shrink));
+      bool crossed = false;
+      for (size_t i = 0; i < ring.size() && !crossed; ++i) {
+        crossed = segment_hits_box(ring[i], ring[(i+1)%ring.size()], box_lo, box_hi);
+      }
+      if (!crossed) return BoundingBox {Vector3 {box_lo.x, 0.f, box_lo.y}, Vector3 {box_hi.x, elevation, box_hi.y}};
     }
+  }
+  return BoundingBox {Vector3 {INFINITY, INFINITY, INFINITY}, Vector3 {-INFINITY, -INFINITY, -INFINITY}};
+}
 
-    ++idx;
+// Walls and roof of a footprint, the ring being relative to origin. Cleans the ring in place.
+// Only counted rings go into the stats, the detail levels' ones would inflate them
+static void earcut_ring(vector<Vector2>& ring, Vector2 origin, BuildingClass building_class, EarcutBatch& out, MeshMode mode,
+  bool counted) {
+  struct ListNode {
+    Vector2 data;
+    uint32_t idx;
+    // position in the reflex set, -1 when convex
+    int32_t reflex_slot;
+    bool is_convex;
+    ListNode* nx;
+    ListNode* pv;
   };
 
-  ListNode* vert_head = &vertices_buffer[0];
-  ListNode* vert_tail = &vertices_buffer[idx-1];
-  vert_tail->nx = vert_head;
-  vert_head->pv = vert_tail;
-  const int num_verts = idx;
+  clean_ring(ring);
+  const size_t num_verts = ring.size();
 
   // the signed area allows us to know if the winding is clockwise or not, useful for determining vertex concaveness 
   float double_signed_area = 0.0f;
-  ListNode* vertex_i = vert_head;
-  do {
-    ListNode* vertex_nx = vertex_i->nx;
-    double_signed_area += (vertex_i->data.x * vertex_nx->data.y - vertex_nx->data.x * vertex_i->data.y);
-    vertex_i = vertex_nx;
-  } while(vertex_i != vert_head);
+  for (size_t i = 0; i < num_verts; ++i) {
+    const Vector2& vi = ring[i];
+    const Vector2& vn = ring[(i+1)%num_verts];
+    double_signed_area += (vi.x * vn.y - vn.x * vi.y);
+  }
+
+  if (num_verts < 3 || double_signed_area == 0.f) {
+    if (counted) ++stats().earcut_degenerate;
+    return;
+  }
   bool winding_clockwise = double_signed_area > 0;
 
-  // keep track of convex vertices
-  auto update_convex = [&winding_clockwise](ListNode* vertex) {
-    Vector2 vi = vertex->data;
-    Vector2 vp = vertex->pv->data;
-    Vector2 vn = vertex->nx->data;
+  // SoA copy of the ring, wrapped around for compute_turns
+  thread_local vector<float> ring_xs, ring_ys, turns;
+  ring_xs.resize(num_verts + 2);
+  ring_ys.resize(num_verts + 2);
+  turns.resize(num_verts);
+  for (size_t i = 0; i < num_verts + 2; ++i) {
+    const Vector2& v = ring[(i + num_verts - 1) % num_verts];
+    ring_xs[i] = v.x;
+    ring_ys[i] = v.y;
+  }
+  compute_turns(ring_xs.data(), ring_ys.data(), num_verts, turns.data());
 
-    Vector2 a = Vector2Subtract(vp, vi), b = Vector2Subtract(vn, vi);
-    float cross = a.x * b.y - a.y * b.x;
-    if ((winding_clockwise && cross < 0) || (!winding_clockwise && cross > 0)) {
-      vertex->is_convex = true;
-    } else {
-      vertex->is_convex = false;
-    }
+  // Vertices layout of a building, the roof ring always comes first:
+  // - MeshMode::Normals: 4 vertices per wall so that roof and walls don't share vertices (they don't share normals either)
+  // - MeshMode::DerivedNormals: normals are computed by the shader, walls only need the ring a second time on the ground
+  const bool split_walls = mode == MeshMode::Normals;
+  BuildingRange range {
+    .first_vertex = (uint32_t)out.xs.size(),
+    .vertex_count = (uint32_t)(num_verts + (split_walls ? 4*num_verts : num_verts)),
+    .first_index = (uint32_t)out.indices.size(),
+    .index_count = 0,
+    .world_offset = origin,
+    .building_class = building_class,
+    .occluder = occluder_box(ring, BUILDING_ELEVATION),
+  };
+  auto push_vertex = [&out](const Vector2& v, float elevation) {
+    out.xs.push_back(v.x);
+    out.ys.push_back(elevation);
+    out.zs.push_back(v.y);
   };
 
-  vertex_i = vert_head;
-  do {
-    update_convex(vertex_i);
-    vertex_i = vertex_i->nx;
-  } while(vertex_i != vert_head);
+  for (size_t i = 0; i < num_verts; ++i) {
+    push_vertex(ring[i], BUILDING_ELEVATION);
+  }
+  if (!split_walls) {
+    for (size_t i = 0; i < num_verts; ++i) {
+      push_vertex(ring[i], 0.f);
+    }
+  }
 
-  vector<Triangle> triangles;
-  triangles.reserve(2*num_verts-2);
+  // walls
+  for (size_t i = 0; i < num_verts; ++i) {
+    const Vector2& vi = ring[i];
+    const Vector2& vn = ring[(i+1)%num_verts];
+    uint32_t vi_bottom, vi_top, vn_top, vn_bottom;
+    if (split_walls) {
+      const uint32_t base = num_verts + 4*i;
+      vi_bottom = base, vi_top = base+1, vn_top = base+2, vn_bottom = base+3;
+      push_vertex(vi, 0.f);
+      push_vertex(vi, BUILDING_ELEVATION);
+      push_vertex(vn, BUILDING_ELEVATION);
+      push_vertex(vn, 0.f);
+    } else {
+      vi_top = i, vn_top = (i+1)%num_verts;
+      vi_bottom = num_verts + vi_top, vn_bottom = num_verts + vn_top;
+    }
 
-  // before performing the actual earcut, we'll generate side faces (walls)
-  // we are doing that before earcutting because the process messes up the linked list
-  vertex_i = vert_head;
-  do {
     if (winding_clockwise) {
-      triangles.push_back({
-        Vector3 { .x = vertex_i->data.x,      .y = 0.f               , .z = vertex_i->data.y },
-        Vector3 { .x = vertex_i->data.x,      .y = BUILDING_ELEVATION, .z = vertex_i->data.y },
-        Vector3 { .x = vertex_i->nx->data.x,  .y = BUILDING_ELEVATION, .z = vertex_i->nx->data.y },
-      });
-      triangles.push_back({
-        Vector3 { .x = vertex_i->nx->data.x,  .y = 0.f               , .z = vertex_i->nx->data.y },
-        Vector3 { .x = vertex_i->data.x,      .y = 0.f               , .z = vertex_i->data.y },
-        Vector3 { .x = vertex_i->nx->data.x,  .y = BUILDING_ELEVATION, .z = vertex_i->nx->data.y },
-      });
+      out.indices.insert(out.indices.end(), {vi_bottom, vi_top, vn_top, vn_bottom, vi_bottom, vn_top});
     } else {
-      triangles.push_back({
-        Vector3 { .x = vertex_i->data.x,      .y = 0.f               , .z = vertex_i->data.y },
-        Vector3 { .x = vertex_i->nx->data.x,  .y = BUILDING_ELEVATION, .z = vertex_i->nx->data.y },
-        Vector3 { .x = vertex_i->data.x,      .y = BUILDING_ELEVATION, .z = vertex_i->data.y },
-      });
-      triangles.push_back({
-        Vector3 { .x = vertex_i->nx->data.x,  .y = BUILDING_ELEVATION, .z = vertex_i->nx->data.y },
-        Vector3 { .x = vertex_i->data.x,      .y = 0.f               , .z = vertex_i->data.y },
-        Vector3 { .x = vertex_i->nx->data.x,  .y = 0.f               , .z = vertex_i->nx->data.y },
-      });
-    }
-
-    vertex_i = vertex_i->nx;
-  } while (vertex_i != vert_head);
-
-  auto push_triangle = [&triangles, &winding_clockwise, &BUILDING_ELEVATION](Vector2& a, Vector2& b, Vector2& c) {
+      out.indices.insert(out.indices.end(), {vi_bottom, vn_top, vi_top, vn_top, vi_bottom, vn_bottom});
+    }
+  }
+
+  // a, b and c are indices in the roof ring
+  auto push_triangle = [&out, &winding_clockwise](uint32_t a, uint32_t b, uint32_t c) {
     if (winding_clockwise) {
-      triangles.push_back({
-        Vector3 { .x = a.x, .y = BUILDING_ELEVATION, .z = a.y },
-        Vector3 { .x = c.x, .y = BUILDING_ELEVATION, .z = c.y },
-        Vector3 { .x = b.x, .y = BUILDING_ELEVATION, .z = b.y },
-      });
+      out.indices.insert(out.indices.end(), {a, c, b});
     } else {
-      triangles.push_back({
-        Vector3 { .x = a.x, .y = BUILDING_ELEVATION, .z = a.y },
-        Vector3 { .x = b.x, .y = BUILDING_ELEVATION, .z = b.y },
-        Vector3 { .x = c.x, .y = BUILDING_ELEVATION, .z = c.y },
-      });
+      out.indices.insert(out.indices.end(), {a, b, c});
+    }
+  };
+
+  auto finish = [&out, &range]() {
+    range.index_count = out.indices.size() - range.first_index;
+    out.buildings.push_back(range);
+  };
+
+  switch (classify_ring(ring.data(), turns.data(), num_verts, winding_clockwise)) {
+    case RoofShape::Quad: {
+      if (counted) ++stats().earcut_quad;
+      // split along the shortest diagonal, gives better shaped triangles
+      if (Vector2DistanceSqr(ring[0], ring[2]) <= Vector2DistanceSqr(ring[1], ring[3])) {
+        push_triangle(0, 1, 2);
+        push_triangle(0, 2, 3);
+      } else {
+        push_triangle(1, 2, 3);
+        push_triangle(1, 3, 0);
+      }
+      finish();
+      return;
+    }
+    case RoofShape::Convex: {
+      if (counted) ++stats().earcut_convex;
+      for (uint32_t i = 1; i < num_verts-1; ++i) 
+        push_triangle(0, i, i+1);
+      finish();
+      return;
+    }
+    case RoofShape::Concave:
+      if (counted) ++stats().earcut_concave;
+      break;
+  }
+
+  // storing vertices data as a doubly linked list
+  thread_local vector<ListNode> vertices_buffer;
+  vertices_buffer.resize(num_verts);
+  for (size_t idx = 0; idx < num_verts; ++idx) {
+    vertices_buffer[idx].data = ring[idx];
+    vertices_buffer[idx].idx = idx;
+    vertices_buffer[idx].reflex_slot = -1;
+    vertices_buffer[idx].is_convex = true;
+    vertices_buffer[idx].pv = &vertices_buffer[(idx+num_verts-1)%num_verts];
+    vertices_buffer[idx].nx = &vertices_buffer[(idx+1)%num_verts];
+  };
+
+  ListNode* vert_head = &vertices_buffer[0];
+
+  // Only reflex vertices can be inside an ear, they are kept packed (SoA) so that ears 
+  // can be validated several points at a time
+  thread_local vector<float> reflex_xs, reflex_ys;
+  thread_local vector<uint32_t> reflex_owners;
+  reflex_xs.clear();
+  reflex_ys.clear();
+  reflex_owners.clear();
+
+  auto remove_reflex = [](ListNode* vertex) {
+    if (vertex->reflex_slot < 0) return;
+    size_t slot = vertex->reflex_slot;
+    reflex_xs[slot] = reflex_xs.back();
+    reflex_ys[slot] = reflex_ys.back();
+    reflex_owners[slot] = reflex_owners.back();
+    vertices_buffer[reflex_owners[slot]].reflex_slot = slot;
+    reflex_xs.pop_back();
+    reflex_ys.pop_back();
+    reflex_owners.pop_back();
+    vertex->reflex_slot = -1;
+  };
+
+  auto set_convex = [&remove_reflex](ListNode* vertex, bool is_convex) {
+    vertex->is_convex = is_convex;
+    if (is_convex) {
+      remove_reflex(vertex);
+    } else if (vertex->reflex_slot < 0) {
+      vertex->reflex_slot = reflex_owners.size();
+      reflex_xs.push_back(vertex->data.x);
+      reflex_ys.push_back(vertex->data.y);
+      reflex_owners.push_back(vertex->idx);
     }
   };
 
+  // keep track of convex vertices
+  auto update_convex = [&winding_clockwise, &set_convex](ListNode* vertex) {
+    set_convex(vertex, is_convex_turn(turn_cross(vertex->pv->data, vertex->data, vertex->nx->data), winding_clockwise));
+  };
+
+  for (size_t idx = 0; idx < num_verts; ++idx) {
+    set_convex(&vertices_buffer[idx], is_convex_turn(turns[idx], winding_clockwise));
+  }
+
   // actual earcutting
-  int remaining_verts = num_verts;
+  // a full pass over the remaining vertices without finding any ear means the ring can't be
+  // clipped (self-intersections, leftover degeneracies) and we would loop forever
+  const size_t roof_start = out.indices.size();
+  size_t remaining_verts = num_verts;
+  size_t steps_without_ear = 0;
+  bool failed = false;
   for (ListNode* vertex = vert_head; remaining_verts > 3; vertex = vertex->nx) {
+    if (steps_without_ear++ > remaining_verts) {
+      failed = true;
+      break;
+    }
+
     Vector2 vi = vertex->data;
     Vector2 vp = vertex->pv->data;
     Vector2 vn = vertex->nx->data;
 
-    ListNode* p = vertex->nx->nx;
-    bool is_ear = true;
-    while(p != vertex->pv) {
-      if (!p->is_convex && CheckCollisionPointTriangle(p->data, vi, vp, vn)) {
-        is_ear = false;
-        break;
-      }
+    // clipping ears may leave collinear vertices behind, they are neither convex nor reflex
+    // and must be dropped without emitting a (flat) triangle
+    bool is_flat = is_collinear(vp, vi, vn);
 
-      p = p->nx;
-    }
+    // a reflex vertex is never an ear
+    if (!is_flat && !vertex->is_convex) continue;
 
-    if (!is_ear) {
-      if (vertex == vert_tail && remaining_verts == num_verts) 
-        assert(false && "0 ear found for a polygon, this should be investigated");
-      else continue;
-    }
+    if (!is_flat && any_point_in_ear(reflex_xs.data(), reflex_ys.data(), reflex_xs.size(), vp, vi, vn)) continue;
 
-    push_triangle(vp, vi, vn);
+    if (!is_flat) push_triangle(vertex->pv->idx, vertex->idx, vertex->nx->idx);
+    steps_without_ear = 0;
 
     vertex->pv->nx = vertex->nx;
     vertex->nx->pv = vertex->pv;
+    remove_reflex(vertex);
     --remaining_verts;
 
     if (vertex == vert_head) {
       vert_head = vertex->pv; 
-    } else if (vertex == vert_tail) {
-      vert_tail = vertex->nx;
     }
 
     // convexity must be recalculated 
@@ -179,60 +493,840 @@ EarcutResult earcut_single(const Way& w) {
     update_convex(vertex->nx);
   }
 
+  if (failed) {
+    // cheap fallback: roof the building with the convex hull of its footprint
+    if (counted) ++stats().earcut_fallback;
+    out.indices.resize(roof_start);
+
+    vector<uint32_t> hull = convex_hull(ring);
+    // the hull always has a positive area, match it with the ring winding used by push_triangle
+    if (!winding_clockwise) ranges::reverse(hull);
+    for (size_t i = 1; i + 1 < hull.size(); ++i) 
+      push_triangle(hull[0], hull[i], hull[i+1]);
+
+    finish();
+    return;
+  }
+
   // push the remaining triangle
-  push_triangle(vert_head->pv->data, vert_head->data, vert_head->nx->data);
+  push_triangle(vert_head->pv->idx, vert_head->idx, vert_head->nx->idx);
+  finish();
+}
 
-  return EarcutResult { 
-    .triangles = triangles,
-    .world_offset = origin 
+// Mostly building=yes, the other tags tell what the building is used for
+BuildingClass building_class(const Way& building) {
+  auto tag = [&building](string_view key) {
+    auto it = building.tags.find(Tag {.key = key});
+    return it == building.tags.end() ? string_view() : it->value;
+  };
+  auto is_any = [](string_view value, initializer_list<string_view> values) {
+    return ranges::find(values, value) != values.end();
   };
+
+  string_view type = tag("building");
+  string_view amenity = tag("amenity");
+  if (is_any(type, {"school", "hospital", "church", "cathedral", "chapel", "civic", "public", "government", "university", "train_station"})
+    || is_any(amenity, {"school", "hospital", "place_of_worship", "townhall", "library", "university", "police", "fire_station"}))
+    return BuildingClass::Public;
+  if (is_any(type, {"industrial", "warehouse", "factory", "manufacture"}) || !tag("industrial").empty() || !tag("craft").empty())
+    return BuildingClass::Industrial;
+  if (is_any(type, {"commercial", "retail", "office", "supermarket", "hotel"}) 
+    || !tag("shop").empty() || !tag("office").empty() || !tag("tourism").empty() || !amenity.empty())
+    return BuildingClass::Commercial;
+  if (is_any(type, {"house", "residential", "apartments", "detached", "semidetached_house", "terrace", "bungalow"}) 
+    || !tag("addr:housenumber").empty())
+    return BuildingClass::Residential;
+  return BuildingClass::Other;
+}
+
+Color building_color(BuildingClass building_class) {
+  switch (building_class) {
+    case BuildingClass::Residential:
+    return Color {214, 170, 140, 255};
+    case BuildingClass::Commercial:
+    return Color {110, 150, 210, 255};
+    case BuildingClass::Industrial:
+    return Color {150, 150, 160, 255};
+    case BuildingClass::Public:
+    return Color {200, 110, 110, 255};
+    case BuildingClass::Other:
+    default:
+    return DARKPURPLE;
+  }
+}
+
+void earcut_single(const Way& w, EarcutBatch& out, MeshMode mode) {
+  if (w.nodes.empty()) {
+    ++stats().earcut_degenerate;
+    return;
+  }
+
+  // We are not inverting origin.y to keep the world_transform consistent in the return value,
+  // we do need to invert it when generating 2D coordinates below
+  Vector2 origin = to2DCoords(w.nodes[0].longitude, w.nodes[0].latitude);
+
+  // simply transform node coordinates into Vector2s w/ origin being the first node's coordinates
+  // scratch buffers are reused across calls to avoid reallocating for every building
+  thread_local vector<Vector2> ring;
+  ring.clear();
+  for (const Node& n : w.nodes) {
+    ring.push_back(Vector2Subtract(to2DCoords(n.longitude, n.latitude), origin));
+  }
+
+  earcut_ring(ring, origin, building_class(w), out, mode, true);
 }
 
-vector<EarcutMesh> build_meshes(const vector<EarcutResult>& earcuts) {
-  auto build_and_upload_single = [](const EarcutResult& earcut) {
-    Mesh mesh {0};
-    size_t num_tris = earcut.triangles.size();
-    mesh.vertexCount = num_tris * 3;
-    mesh.triangleCount = num_tris;
-    mesh.vertices = (float*)RL_MALLOC(mesh.vertexCount*3*sizeof(float));
-    mesh.normals = (float*)RL_MALLOC(mesh.vertexCount*3*sizeof(float));
+// upper bounds: n roof vertices + 4n wall vertices, 6n wall indices + 3(n-2) roof indices
+static void reserve_batch(EarcutBatch& batch, span<const Way* const> buildings) {
+  size_t num_nodes = 0;
+  for (const Way* w : buildings) num_nodes += w->nodes.size();
 
-    for (int i = 0; i < mesh.triangleCount; ++i) {
-      const Triangle& tri = earcut.triangles[i];
+  batch.xs.reserve(5 * num_nodes);
+  batch.ys.reserve(5 * num_nodes);
+  batch.zs.reserve(5 * num_nodes);
+  batch.indices.reserve(9 * num_nodes);
+  batch.buildings.reserve(buildings.size());
+}
 
-      Vector3 v1 = get<0>(tri);
-      mesh.vertices[i*9+0] = v1.x;
-      mesh.vertices[i*9+1] = v1.y;
-      mesh.vertices[i*9+2] = v1.z;
+void append_batch(EarcutBatch& batch, const EarcutBatch& other) {
+  uint32_t vertex_offset = (uint32_t)batch.xs.size(), index_offset = (uint32_t)batch.indices.size();
+  batch.xs.insert(batch.xs.end(), other.xs.begin(), other.xs.end());
+  batch.ys.insert(batch.ys.end(), other.ys.begin(), other.ys.end());
+  batch.zs.insert(batch.zs.end(), other.zs.begin(), other.zs.end());
+  // indices are relative to their building, they are copied as is
+  batch.indices.insert(batch.indices.end(), other.indices.begin(), other.indices.end());
+  for (BuildingRange range : other.buildings) {
+    range.first_vertex += vertex_offset;
+    range.first_index += index_offset;
+    batch.buildings.push_back(range);
+  }
+}
 
-      Vector3 v2 = get<1>(tri);
-      mesh.vertices[i*9+3] = v2.x;
-      mesh.vertices[i*9+4] = v2.y;
-      mesh.vertices[i*9+5] = v2.z;
+// Calls build(first, last, out) on contiguous slices of [0, count) across the pool's workers
+template <typename F>
+static EarcutBatch build_sliced(size_t count, ThreadPool& pool, F&& build) {
+  // under that, dispatching a slice costs more than triangulating it
+  const size_t MIN_BUILDINGS_PER_SLICE = 64;
+  // more slices than workers so that a slice full of concave buildings doesn't hold everyone back
+  const size_t SLICES_PER_WORKER = 4;
 
-      Vector3 v3 = get<2>(tri);
-      mesh.vertices[i*9+6] = v3.x;
-      mesh.vertices[i*9+7] = v3.y;
-      mesh.vertices[i*9+8] = v3.z;
+  size_t num_slices = clamp<size_t>(count / MIN_BUILDINGS_PER_SLICE, 1, pool.size() * SLICES_PER_WORKER);
+  if (num_slices == 1 || pool.size() == 1) {
+    EarcutBatch batch;
+    build(0, count, batch);
+    return batch;
+  }
 
-      Vector3 normal = Vector3Normalize(Vector3CrossProduct(Vector3Subtract(v2, v1), Vector3Subtract(v3, v1)));
+  // slices are contiguous and merged back in order, the output doesn't depend on the number of workers
+  vector<EarcutBatch> slices(num_slices);
+  vector<future<void>> pending;
+  pending.reserve(num_slices);
+  for (size_t s = 0; s < num_slices; ++s) {
+    size_t first = count * s / num_slices, last = count * (s+1) / num_slices;
+    pending.push_back(pool.submit([&slice = slices[s], first, last, &build]() {
+      build(first, last, slice);
+    }));
+  }
 
-      mesh.normals[i*9+0] = normal.x;
-      mesh.normals[i*9+1] = normal.y;
-      mesh.normals[i*9+2] = normal.z;
+  for (future<void>& f : pending) f.get();
+
+  EarcutBatch batch;
+  size_t num_vertices = 0, num_indices = 0, num_buildings = 0;
+  for (const EarcutBatch& slice : slices) {
+    num_vertices += slice.xs.size();
+    num_indices += slice.indices.size();
+    num_buildings += slice.buildings.size();
+  }
+  batch.xs.reserve(num_vertices);
+  batch.ys.reserve(num_vertices);
+  batch.zs.reserve(num_vertices);
+  batch.indices.reserve(num_indices);
+  batch.buildings.reserve(num_buildings);
+  for (const EarcutBatch& slice : slices) append_batch(batch, slice);
+
+  return batch;
+}
 
-      mesh.normals[i*9+3] = normal.x;
-      mesh.normals[i*9+4] = normal.y;
-      mesh.normals[i*9+5] = normal.z;
+EarcutBatch earcut_buildings(span<const Way* const> buildings, MeshMode mode, ThreadPool& pool) {
+  auto start = chrono::steady_clock::now();
+  EarcutBatch batch = build_sliced(buildings.size(), pool, [&buildings, mode](size_t first, size_t last, EarcutBatch& out) {
+    span<const Way* const> slice = buildings.subspan(first, last - first);
+    reserve_batch(out, slice);
+    for (const Way* w : slice) earcut_single(*w, out, mode);
+  });
 
-      mesh.normals[i*9+6] = normal.x;
-      mesh.normals[i*9+7] = normal.y;
-      mesh.normals[i*9+8] = normal.z;
+  auto elapsed = chrono::steady_clock::now() - start;
+  stats().earcut_ns += chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+  return batch;
+}
+
+// Mesh assembly kernels. Quantization rounds half away from zero like roundf, written so that 
+// the vector and scalar paths give the same integers
+static inline int16_t quantize(float v) {
+  return (int16_t)(int32_t)(v + (v < 0.f ? -.5f : .5f));
+}
+
+#ifdef HAS_SIMD
+static inline i32x4 quantize4(f32x4 v) {
+  return __builtin_convertvector(v + select4(v < splat4(0.f), splat4(-.5f), splat4(.5f)), i32x4);
+}
+#endif
+
+// Chunk relative, quantized positions of count vertices, (xs, ys, zs) being relative to offset
+template<typename V>
+static void quantize_positions(const float* xs, const float* ys, const float* zs, uint32_t count, Vector2 offset, float inv_scale, V* out) {
+  uint32_t i = 0;
+#ifdef HAS_SIMD
+  const f32x4 ox = splat4(offset.x), oz = splat4(offset.y), s = splat4(inv_scale);
+  for (; i + 4 <= count; i += 4) {
+    i32x4 qx = quantize4((load4(xs+i) + ox) * s);
+    i32x4 qy = quantize4(load4(ys+i) * s);
+    i32x4 qz = quantize4((load4(zs+i) + oz) * s);
+    for (int k = 0; k < 4; ++k) {
+      out[i+k].position[0] = (int16_t)qx[k];
+      out[i+k].position[1] = (int16_t)qy[k];
+      out[i+k].position[2] = (int16_t)qz[k];
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i].position[0] = quantize((xs[i] + offset.x) * inv_scale);
+    out[i].position[1] = quantize(ys[i] * inv_scale);
+    out[i].position[2] = quantize((zs[i] + offset.y) * inv_scale);
+  }
+}
+
+// Octahedral encoding of an unnormalized face normal. Dividing by the L1 norm already projects on 
+// the octahedron, the L2 normalization (and its sqrt) would be redundant. Same steps as oct_encode
+static inline void encode_face_normal(float cx, float cy, float cz, int8_t out[2]) {
+  float l1 = fabsf(cx) + fabsf(cy) + fabsf(cz);
+  float x = cx / l1, y = cy / l1;
+  if (cz < 0.f) {
+    float fx = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+    float fy = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+    x = fx;
+    y = fy;
+  }
+  out[0] = (int8_t)quantize(clamp(x, -1.f, 1.f) * 127.f);
+  out[1] = (int8_t)quantize(clamp(y, -1.f, 1.f) * 127.f);
+}
+
+// Writes the face normal of every triangle to its 3 vertices. Flat triangles are skipped, they have no normal.
+// The roof and each wall own their vertices, so every vertex belongs to a single face orientation
+static void face_normals(const float* xs, const float* ys, const float* zs, const uint32_t* indices, uint32_t index_count, PackedVertex* out) {
+  uint32_t t = 0;
+#ifdef HAS_SIMD
+  const f32x4 zero = splat4(0.f), one = splat4(1.f), minus_one = splat4(-1.f), range = splat4(127.f);
+  for (; t + 12 <= index_count; t += 12) {
+    const uint32_t* tri = indices + t;
+    auto gather = [tri](const float* v, int corner) {
+      return f32x4 {v[tri[corner]], v[tri[3+corner]], v[tri[6+corner]], v[tri[9+corner]]};
+    };
+    f32x4 x1 = gather(xs, 0), y1 = gather(ys, 0), z1 = gather(zs, 0);
+    f32x4 ax = gather(xs, 1) - x1, ay = gather(ys, 1) - y1, az = gather(zs, 1) - z1;
+    f32x4 bx = gather(xs, 2) - x1, by = gather(ys, 2) - y1, bz = gather(zs, 2) - z1;
+    f32x4 cx = ay * bz - az * by;
+    f32x4 cy = az * bx - ax * bz;
+    f32x4 cz = ax * by - ay * bx;
+
+    f32x4 l1 = abs4(cx) + abs4(cy) + abs4(cz);
+    i32x4 flat = l1 == zero;
+    l1 = select4(flat, one, l1);
+    f32x4 x = cx / l1, y = cy / l1;
+    f32x4 fx = (one - abs4(y)) * select4(x >= zero, one, minus_one);
+    f32x4 fy = (one - abs4(x)) * select4(y >= zero, one, minus_one);
+    i32x4 lower = cz < zero;
+    x = select4(lower, fx, x);
+    y = select4(lower, fy, y);
+    auto clamp4 = [&](f32x4 v) { return select4(v < minus_one, minus_one, select4(v > one, one, v)); };
+    i32x4 ex = quantize4(clamp4(x) * range);
+    i32x4 ey = quantize4(clamp4(y) * range);
+
+    for (int k = 0; k < 4; ++k) {
+      if (flat[k]) continue;
+      for (int corner = 0; corner < 3; ++corner) {
+        out[tri[3*k+corner]].normal[0] = (int8_t)ex[k];
+        out[tri[3*k+corner]].normal[1] = (int8_t)ey[k];
+      }
+    }
+  }
+#endif
+  for (; t < index_count; t += 3) {
+    uint32_t i1 = indices[t+0], i2 = indices[t+1], i3 = indices[t+2];
+    float ax = xs[i2] - xs[i1], ay = ys[i2] - ys[i1], az = zs[i2] - zs[i1];
+    float bx = xs[i3] - xs[i1], by = ys[i3] - ys[i1], bz = zs[i3] - zs[i1];
+    float cx = ay * bz - az * by;
+    float cy = az * bx - ax * bz;
+    float cz = ax * by - ay * bx;
+    if (fabsf(cx) + fabsf(cy) + fabsf(cz) == 0.f) continue;
+
+    for (uint32_t idx : {i1, i2, i3}) {
+      encode_face_normal(cx, cy, cz, out[idx].normal);
+    }
+  }
+}
+
+// raylib meshes use 16 bits indices
+static const uint32_t MAX_MESH_VERTICES = 65536;
+static const float QUANTIZATION_RANGE = 32767.f;
+
+// build_meshes, counted in the stats or not like earcut_ring
+static ChunkMeshes pack_meshes(const EarcutBatch& batch, Vector2 origin, MeshMode mode, optional<MeshFrame> frame, bool counted) {
+
+  // offset from a building's vertices to the chunk's origin
+  auto chunk_offset = [&origin](const BuildingRange& building) {
+    return Vector2Subtract(building.world_offset, origin);
+  };
+
+  // the scale is chosen so that the farthest vertex from the origin still fits in an int16.
+  // Buildings are fetched whole so they can stick out of the chunk's bounds
+  float max_extent = 0.f;
+  // chunk relative bounds of each building
+  vector<BoundingBox> building_bounds(batch.buildings.size());
+  for (size_t b = 0; b < batch.buildings.size(); ++b) {
+    const BuildingRange& building = batch.buildings[b];
+    Vector2 offset = chunk_offset(building);
+    const float* xs = &batch.xs[building.first_vertex];
+    const float* ys = &batch.ys[building.first_vertex];
+    const float* zs = &batch.zs[building.first_vertex];
+    BoundingBox box {Vector3 {INFINITY, INFINITY, INFINITY}, Vector3 {-INFINITY, -INFINITY, -INFINITY}};
+    for (uint32_t i = 0; i < building.vertex_count; ++i) {
+      Vector3 p {xs[i] + offset.x, ys[i], zs[i] + offset.y};
+      box.min = Vector3Min(box.min, p);
+      box.max = Vector3Max(box.max, p);
+      max_extent = max({max_extent, fabsf(p.x), fabsf(p.y), fabsf(p.z)});
+    }
+    building_bounds[b] = box;
+  }
+
+  auto building_center = [&building_bounds](size_t b) {
+    const BoundingBox& box = building_bounds[b];
+    return Vector2 {(box.min.x + box.max.x) * .5f, (box.min.z + box.max.z) * .5f};
+  };
+  if (!frame) {
+    frame = MeshFrame {
+      .position_scale = max_extent > 0.f ? max_extent / QUANTIZATION_RANGE : 1.f,
+      .grid_min = {INFINITY, INFINITY}, 
+      .grid_max = {-INFINITY, -INFINITY},
+    };
+    for (size_t b = 0; b < batch.buildings.size(); ++b) {
+      if (batch.buildings[b].vertex_count == 0) continue;
+      Vector2 c = building_center(b);
+      frame->grid_min = Vector2 {min(frame->grid_min.x, c.x), min(frame->grid_min.y, c.y)};
+      frame->grid_max = Vector2 {max(frame->grid_max.x, c.x), max(frame->grid_max.y, c.y)};
+    }
+  }
+
+  ChunkMeshes out {
+    .origin = origin,
+    .position_scale = frame->position_scale,
+    .mode = mode,
+    .geometric_error = 0.f,
+    .meshes = {},
+    .bounds = {},
+  };
+
+  // Buildings are grouped in a CLUSTER_GRID x CLUSTER_GRID grid over the chunk, each cell giving its own meshes.
+  // Clusters are compact enough to be frustum culled, and few enough to keep draw calls low
+  const int CLUSTER_GRID = 4;
+  Vector2 grid_min = frame->grid_min, grid_max = frame->grid_max;
+  auto cluster_of = [&](size_t b) {
+    Vector2 c = building_center(b);
+    Vector2 size = Vector2Subtract(grid_max, grid_min);
+    int cx = size.x > 0.f ? clamp((int)((c.x - grid_min.x) / size.x * CLUSTER_GRID), 0, CLUSTER_GRID - 1) : 0;
+    int cz = size.y > 0.f ? clamp((int)((c.y - grid_min.y) / size.y * CLUSTER_GRID), 0, CLUSTER_GRID - 1) : 0;
+    return cz * CLUSTER_GRID + cx;
+  };
+  // inside a cluster, buildings follow a Z-order curve so that neighbours are next to each other in the mesh.
+  // Occlusion culling hides buildings in groups, they then come out as a few contiguous index ranges
+  auto morton_of = [&](size_t b) {
+    Vector2 c = building_center(b);
+    Vector2 size = Vector2Subtract(grid_max, grid_min);
+    uint32_t x = size.x > 0.f ? (uint32_t)clamp((c.x - grid_min.x) / size.x * 65535.f, 0.f, 65535.f) : 0;
+    uint32_t z = size.y > 0.f ? (uint32_t)clamp((c.y - grid_min.y) / size.y * 65535.f, 0.f, 65535.f) : 0;
+    uint32_t code = 0;
+    for (int bit = 0; bit < 16; ++bit) {
+      code |= ((x >> bit) & 1u) << (2*bit);
+      code |= ((z >> bit) & 1u) << (2*bit + 1);
+    }
+    return code;
+  };
+  vector<uint64_t> keys(batch.buildings.size());
+  vector<uint32_t> order(batch.buildings.size());
+  for (size_t b = 0; b < batch.buildings.size(); ++b) {
+    keys[b] = batch.buildings[b].vertex_count > 0 ? (uint64_t)cluster_of(b) << 32 | morton_of(b) : 0;
+    order[b] = b;
+  }
+  // stable, buildings with the same key keep the batch order
+  ranges::stable_sort(order, {}, [&keys](uint32_t b) { return keys[b]; });
+
+  // a cluster's buildings are merged into as few meshes as the 16 bits indices allow
+  EarcutMesh* mesh = nullptr;
+  BoundingBox* mesh_bounds = nullptr;
+  int mesh_cluster = -1;
+  auto mesh_vertex_count = [&mode](const EarcutMesh& m) {
+    return mode == MeshMode::DerivedNormals ? m.positions.size() : m.vertices.size();
+  };
+
+  for (uint32_t b : order) {
+    const BuildingRange& building = batch.buildings[b];
+    if (building.vertex_count > MAX_MESH_VERTICES) {
+      TraceLog(LOG_WARNING, "MESH: Building of %u vertices skipped, too large for 16 bits indices", building.vertex_count);
+      continue;
+    }
+    if (building.vertex_count == 0) continue;
+
+    int cluster = (int)(keys[b] >> 32);
+    if (mesh == nullptr || cluster != mesh_cluster || mesh_vertex_count(*mesh) + building.vertex_count > MAX_MESH_VERTICES) {
+      mesh = &out.meshes.emplace_back();
+      mesh_bounds = &out.bounds.emplace_back(building_bounds[b]);
+      mesh_cluster = cluster;
+    }
+    mesh_bounds->min = Vector3Min(mesh_bounds->min, building_bounds[b].min);
+    mesh_bounds->max = Vector3Max(mesh_bounds->max, building_bounds[b].max);
+
+    Vector3 world_offset {building.world_offset.x, 0.f, building.world_offset.y};
+    mesh->buildings.bounds.push_back(BoundingBox {
+      Vector3Add(building_bounds[b].min, Vector3 {origin.x, 0.f, origin.y}),
+      Vector3Add(building_bounds[b].max, Vector3 {origin.x, 0.f, origin.y}),
+    });
+    mesh->buildings.occluders.push_back(BoundingBox {
+      Vector3Add(building.occluder.min, world_offset),
+      Vector3Add(building.occluder.max, world_offset),
+    });
+    mesh->buildings.indices.push_back(IndexRange {(uint32_t)mesh->indices.size(), building.index_count});
+
+    uint32_t base = (uint32_t)mesh_vertex_count(*mesh);
+    size_t first_index = mesh->indices.size();
+    mesh->indices.resize(first_index + building.index_count);
+    for (uint32_t i = 0; i < building.index_count; ++i) 
+      mesh->indices[first_index + i] = (uint16_t)(base + batch.indices[building.first_index + i]);
+
+    const float* xs = &batch.xs[building.first_vertex];
+    const float* ys = &batch.ys[building.first_vertex];
+    const float* zs = &batch.zs[building.first_vertex];
+    float inv_scale = 1.f / out.position_scale;
+
+    if (mode == MeshMode::DerivedNormals) {
+      mesh->positions.resize(base + building.vertex_count, PackedPosition {.feature = (uint8_t)building.building_class});
+      quantize_positions(xs, ys, zs, building.vertex_count, chunk_offset(building), inv_scale, &mesh->positions[base]);
+    } else {
+      mesh->vertices.resize(base + building.vertex_count, PackedVertex {.feature = (uint8_t)building.building_class});
+      quantize_positions(xs, ys, zs, building.vertex_count, chunk_offset(building), inv_scale, &mesh->vertices[base]);
+      // normals are computed on the building relative floats, before quantization
+      face_normals(xs, ys, zs, &batch.indices[building.first_index], building.index_count, &mesh->vertices[base]);
+    }
+
+    if (counted) ++stats().buildings_meshed;
+  }
+
+  for (const EarcutMesh& m : out.meshes) {
+    if (counted) stats().mesh_bytes += m.cpu_bytes();
+  }
+  // to world space, culling happens there
+  for (BoundingBox& box : out.bounds) {
+    box.min = Vector3Add(box.min, Vector3 {origin.x, 0.f, origin.y});
+    box.max = Vector3Add(box.max, Vector3 {origin.x, 0.f, origin.y});
+  }
+
+  return out;
+}
+
+ChunkMeshes build_meshes(const EarcutBatch& batch, Vector2 origin, MeshMode mode, optional<MeshFrame> frame) {
+  return pack_meshes(batch, origin, mode, frame, true);
+}
+
+// Level 1 drops footprint vertices closer than this to their neighbours' line
+static const float LOD_SIMPLIFY_TOLERANCE = .15f;
+// Level 2 merges the buildings of each cell of this size
+static const float LOD_BLOCK_SIZE = 2.5f;
+
+// Footprint of a building of the batch, read back from its roof ring (see earcut_ring for the vertex layout)
+static void roof_ring(const EarcutBatch& batch, const BuildingRange& building, MeshMode mode, vector<Vector2>& ring) {
+  uint32_t n = building.vertex_count / (mode == MeshMode::Normals ? 5 : 2);
+  ring.resize(n);
+  for (uint32_t i = 0; i < n; ++i) 
+    ring[i] = Vector2 {batch.xs[building.first_vertex + i], batch.zs[building.first_vertex + i]};
+}
+
+// Touching or collinear segments count as crossing
+static bool segments_cross(Vector2 a, Vector2 b, Vector2 c, Vector2 d) {
+  auto orient = [](Vector2 p, Vector2 q, Vector2 r) { return (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x); };
+  return orient(a, b, c) * orient(a, b, d) <= 0.f && orient(c, d, a) * orient(c, d, b) <= 0.f;
+}
+
+static float distance_to_segment(Vector2 p, Vector2 a, Vector2 b) {
+  Vector2 ab = Vector2Subtract(b, a);
+  float length_sqr = Vector2DotProduct(ab, ab);
+  float t = length_sqr > 0.f ? clamp(Vector2DotProduct(Vector2Subtract(p, a), ab) / length_sqr, 0.f, 1.f) : 0.f;
+  return Vector2Distance(p, Vector2Add(a, Vector2Scale(ab, t)));
+}
+
+// Visvalingam-Whyatt, measured with the distance to the neighbours' line rather than the triangle's area:
+// the vertex moving the outline the least goes first, until it would move it by more than tolerance.
+// Removals that would make the ring cross itself are skipped. Returns the farthest a removed vertex
+// ends up from the simplified outline, removals add up so it can exceed tolerance
+static float simplify_ring(vector<Vector2>& ring, float tolerance) {
+  thread_local vector<pair<float, uint32_t>> candidates;
+  thread_local vector<Vector2> original;
+  // index in original of each vertex of ring
+  thread_local vector<uint32_t> kept;
+  original.assign(ring.begin(), ring.end());
+  kept.resize(ring.size());
+  iota(kept.begin(), kept.end(), 0u);
+  while (ring.size() > 3) {
+    const size_t n = ring.size();
+    candidates.clear();
+    for (size_t i = 0; i < n; ++i) {
+      Vector2 vp = ring[(i+n-1)%n], vi = ring[i], vn = ring[(i+1)%n];
+      float base = Vector2Distance(vp, vn);
+      float distance = base > 0.f ? fabsf(turn_cross(vp, vi, vn)) / base : Vector2Distance(vi, vp);
+      if (distance <= tolerance) candidates.push_back({distance, (uint32_t)i});
     }
+    ranges::sort(candidates);
 
-    return EarcutMesh {mesh, earcut.world_offset};
+    bool removed = false;
+    for (auto [distance, i] : candidates) {
+      size_t p = (i+n-1)%n, nx = (i+1)%n;
+      bool crosses = false;
+      for (size_t j = 0; j < n && !crosses; ++j) {
+        size_t k = (j+1)%n;
+        // the edges sharing a vertex with the new one
+        if (j == p || k == p || j == nx || k == nx || j == i || k == i) continue;
+        crosses = segments_cross(ring[p], ring[nx], ring[j], ring[k]);
+      }
+      if (crosses) continue;
+
+      ring.erase(ring.begin() + i);
+      kept.erase(kept.begin() + i);
+      removed = true;
+      break;
+    }
+    if (!removed) break;
+  }
+
+  // the removed vertices between two kept ones are replaced by the segment joining them
+  float deviation = 0.f;
+  const size_t n = kept.size(), total = original.size();
+  for (size_t k = 0; k < n; ++k) {
+    uint32_t a = kept[k], b = kept[(k+1)%n];
+    for (size_t i = (a+1)%total; i != b; i = (i+1)%total)
+      deviation = max(deviation, distance_to_segment(original[i], original[a], original[b]));
+  }
+  return deviation;
+}
+
+// max_deviation is the largest simplify_ring result over the buildings
+static EarcutBatch simplified_batch(const EarcutBatch& batch, MeshMode mode, float tolerance, ThreadPool& pool, float& max_deviation) {
+  vector<float> deviations(batch.buildings.size(), 0.f);
+  EarcutBatch simplified = build_sliced(batch.buildings.size(), pool, [&](size_t first, size_t last, EarcutBatch& out) {
+    thread_local vector<Vector2> ring;
+    for (size_t b = first; b < last; ++b) {
+      const BuildingRange& building = batch.buildings[b];
+      roof_ring(batch, building, mode, ring);
+      deviations[b] = simplify_ring(ring, tolerance);
+      earcut_ring(ring, building.world_offset, building.building_class, out, mode, false);
+    }
+  });
+  max_deviation = deviations.empty() ? 0.f : ranges::max(deviations);
+  return simplified;
+}
+
+// Hull edges are checked every block_size / BLOCK_DEVIATION_SAMPLES for how far they pass from the footprints
+static const int BLOCK_DEVIATION_SAMPLES = 8;
+
+// Farthest a point of the hull's edges is from the footprints, rings_start splitting points into them.
+// The hull's vertices are footprint vertices and its edges along a footprint don't move, the ones
+// bridging two buildings or the notch of a concave one do. They are sampled every step, and the distance
+// can't grow by more than half a step between two samples: the result is an upper bound
+static float hull_deviation(span<const uint32_t> hull, span<const Vector2> points, span<const size_t> rings_start, float step) {
+  thread_local vector<uint32_t> ring_of;
+  thread_local vector<BoundingBox> ring_bounds;
+  const size_t ring_count = rings_start.size() - 1;
+  ring_of.resize(points.size());
+  ring_bounds.assign(ring_count, BoundingBox {{INFINITY, 0.f, INFINITY}, {-INFINITY, 0.f, -INFINITY}});
+  for (size_t r = 0; r < ring_count; ++r) {
+    for (size_t i = rings_start[r]; i < rings_start[r+1]; ++i) {
+      ring_of[i] = r;
+      ring_bounds[r].min = Vector3Min(ring_bounds[r].min, Vector3 {points[i].x, 0.f, points[i].y});
+      ring_bounds[r].max = Vector3Max(ring_bounds[r].max, Vector3 {points[i].x, 0.f, points[i].y});
+    }
+  }
+
+  float deviation = 0.f;
+  bool bridged = false;
+  for (size_t e = 0; e < hull.size(); ++e) {
+    uint32_t ia = hull[e], ib = hull[(e+1)%hull.size()];
+    size_t r = ring_of[ia], first = rings_start[r], last = rings_start[r+1] - 1;
+    bool along_footprint = ring_of[ib] == r && (ib == ia + 1 || ia == ib + 1 || (min(ia, ib) == first && max(ia, ib) == last));
+    if (along_footprint) continue;
+    bridged = true;
+
+    Vector2 a = points[ia], b = points[ib];
+    int samples = max(1, (int)ceilf(Vector2Distance(a, b) / step));
+    for (int s = 1; s < samples; ++s) {
+      Vector2 p = Vector2Add(a, Vector2Scale(Vector2Subtract(b, a), (float)s / samples));
+      float distance = INFINITY;
+      for (size_t r = 0; r < ring_count && distance > deviation; ++r) {
+        // the distance to the ring's bounds is a lower bound of the distance to the ring
+        const BoundingBox& box = ring_bounds[r];
+        float dx = max({box.min.x - p.x, 0.f, p.x - box.max.x}), dz = max({box.min.z - p.y, 0.f, p.y - box.max.z});
+        if (dx * dx + dz * dz >= distance * distance) continue;
+        span<const Vector2> ring = points.subspan(rings_start[r], rings_start[r+1] - rings_start[r]);
+        if (point_in_ring(ring, p)) {
+          distance = 0.f;
+          break;
+        }
+        for (size_t i = 0; i < ring.size(); ++i)
+          distance = min(distance, distance_to_segment(p, ring[i], ring[(i+1)%ring.size()]));
+      }
+      // past the stop above, distance is only known to be at most the current deviation
+      deviation = max(deviation, distance);
+    }
+  }
+  return bridged ? deviation + .5f * step : 0.f;
+}
+
+// Buildings whose first node falls in the same block_size cell are replaced by the extrusion of their convex hull.
+// Their footprints can reach past the cell, max_deviation is the largest hull_deviation over the blocks
+static EarcutBatch block_batch(const EarcutBatch& batch, MeshMode mode, float block_size, ThreadPool& pool, float& max_deviation) {
+  // buildings sorted by cell, a block being a run of the same cell
+  vector<pair<int64_t, uint32_t>> cells(batch.buildings.size());
+  for (size_t b = 0; b < batch.buildings.size(); ++b) {
+    Vector2 offset = batch.buildings[b].world_offset;
+    int64_t cx = (int64_t)floorf(offset.x / block_size), cz = (int64_t)floorf(offset.y / block_size);
+    cells[b] = {cx * (1ll << 32) + (uint32_t)cz, (uint32_t)b};
+  }
+  ranges::sort(cells);
+  vector<size_t> block_starts;
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (i == 0 || cells[i].first != cells[i-1].first) block_starts.push_back(i);
+  }
+  block_starts.push_back(cells.size());
+
+  vector<float> deviations(block_starts.size() - 1, 0.f);
+  EarcutBatch blocks = build_sliced(block_starts.size() - 1, pool, [&](size_t first, size_t last, EarcutBatch& out) {
+    thread_local vector<Vector2> points, ring;
+    thread_local vector<size_t> rings_start;
+    for (size_t block = first; block < last; ++block) {
+      // relative to the block's first building
+      Vector2 origin = batch.buildings[cells[block_starts[block]].second].world_offset;
+      points.clear();
+      rings_start.clear();
+      // the block takes the class most of its buildings have
+      array<uint32_t, 256> class_counts {};
+      for (size_t i = block_starts[block]; i < block_starts[block+1]; ++i) {
+        const BuildingRange& building = batch.buildings[cells[i].second];
+        ++class_counts[(uint8_t)building.building_class];
+        Vector2 offset = Vector2Subtract(building.world_offset, origin);
+        roof_ring(batch, building, mode, ring);
+        rings_start.push_back(points.size());
+        for (Vector2 v : ring) points.push_back(Vector2Add(v, offset));
+      }
+      rings_start.push_back(points.size());
+
+      vector<uint32_t> hull = convex_hull(points);
+      ring.clear();
+      for (uint32_t h : hull) ring.push_back(points[h]);
+      deviations[block] = hull_deviation(hull, points, rings_start, block_size / BLOCK_DEVIATION_SAMPLES);
+      earcut_ring(ring, origin, (BuildingClass)(ranges::max_element(class_counts) - class_counts.begin()), out, mode, false);
+    }
+  });
+  max_deviation = deviations.empty() ? 0.f : ranges::max(deviations);
+  return blocks;
+}
+
+vector<ChunkMeshes> build_lod_meshes(const EarcutBatch& batch, Vector2 origin, MeshMode mode, ThreadPool& pool, optional<MeshFrame> frame,
+  bool counted) {
+  vector<ChunkMeshes> lods;
+  lods.reserve(LOD_COUNT);
+  lods.push_back(pack_meshes(batch, origin, mode, frame, counted));
+
+  // the coarser levels are left out of the triangulation and mesh counters, they have their own timer
+  auto start = chrono::steady_clock::now();
+  float simplify_deviation = 0.f;
+  EarcutBatch simplified = simplified_batch(batch, mode, LOD_SIMPLIFY_TOLERANCE, pool, simplify_deviation);
+  float block_deviation = 0.f;
+  EarcutBatch blocks = block_batch(batch, mode, LOD_BLOCK_SIZE, pool, block_deviation);
+  lods.push_back(pack_meshes(simplified, origin, mode, frame, false));
+  lods.push_back(pack_meshes(blocks, origin, mode, frame, false));
+  auto elapsed = chrono::steady_clock::now() - start;
+  stats().lod_ns += chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+
+  lods[1].geometric_error = simplify_deviation;
+  lods[2].geometric_error = block_deviation;
+  return lods;
+}
+
+vector<size_t> progressive_batches(vector<const Way*>& buildings, size_t first_batch, size_t max_batch) {
+  // blocks are found like block_batch does, from the building's first node
+  auto cell_of = [](const Way* w) {
+    if (w->nodes.empty()) return pair<int64_t, int64_t> {0, 0};
+    Vector2 p = to2DCoords(w->nodes[0].longitude, w->nodes[0].latitude);
+    return pair<int64_t, int64_t> {(int64_t)floorf(p.x / LOD_BLOCK_SIZE), (int64_t)floorf(p.y / LOD_BLOCK_SIZE)};
+  };
+  int64_t min_x = INT64_MAX, min_z = INT64_MAX;
+  for (const Way* w : buildings) {
+    auto [x, z] = cell_of(w);
+    min_x = min(min_x, x);
+    min_z = min(min_z, z);
+  }
+  // Z-order of the blocks, so that a batch covers a compact area and few of the chunk's clusters
+  vector<pair<uint64_t, const Way*>> keyed(buildings.size());
+  for (size_t b = 0; b < buildings.size(); ++b) {
+    auto [x, z] = cell_of(buildings[b]);
+    uint64_t code = 0;
+    for (int bit = 0; bit < 32; ++bit) {
+      code |= (((uint64_t)(x - min_x) >> bit) & 1u) << (2*bit);
+      code |= (((uint64_t)(z - min_z) >> bit) & 1u) << (2*bit + 1);
+    }
+    keyed[b] = {code, buildings[b]};
+  }
+  ranges::stable_sort(keyed, {}, [](const auto& k) { return k.first; });
+  for (size_t b = 0; b < keyed.size(); ++b) buildings[b] = keyed[b].second;
+
+  vector<size_t> starts {0};
+  size_t batch_size = max<size_t>(first_batch, 1);
+  for (size_t b = 1; b < keyed.size(); ++b) {
+    if (b - starts.back() < batch_size || keyed[b].first == keyed[b-1].first) continue;
+    starts.push_back(b);
+    batch_size = min(2 * batch_size, max(max_batch, first_batch));
+  }
+  if (!keyed.empty()) starts.push_back(keyed.size());
+  return starts;
+}
+
+MeshFrame fit_mesh_frame(span<const Way* const> buildings, Vector2 origin) {
+  // every level's vertices come from the nodes, the hulls of level 2 included
+  float max_extent = BUILDING_ELEVATION;
+  Vector2 grid_min {INFINITY, INFINITY}, grid_max {-INFINITY, -INFINITY};
+  for (const Way* w : buildings) {
+    if (w->nodes.empty()) continue;
+    Vector2 lo {INFINITY, INFINITY}, hi {-INFINITY, -INFINITY};
+    for (const Node& n : w->nodes) {
+      Vector2 p = Vector2Subtract(to2DCoords(n.longitude, n.latitude), origin);
+      lo = Vector2 {min(lo.x, p.x), min(lo.y, p.y)};
+      hi = Vector2 {max(hi.x, p.x), max(hi.y, p.y)};
+    }
+    max_extent = max({max_extent, fabsf(lo.x), fabsf(lo.y), fabsf(hi.x), fabsf(hi.y)});
+    Vector2 c = Vector2Scale(Vector2Add(lo, hi), .5f);
+    grid_min = Vector2 {min(grid_min.x, c.x), min(grid_min.y, c.y)};
+    grid_max = Vector2 {max(grid_max.x, c.x), max(grid_max.y, c.y)};
+  }
+  return MeshFrame {
+    .position_scale = max_extent / QUANTIZATION_RANGE,
+    .grid_min = grid_min,
+    .grid_max = grid_max,
+  };
+}
+
+static void put_varint(vector<uint8_t>& out, uint32_t v) {
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+static uint32_t get_varint(const uint8_t*& p) {
+  uint32_t v = 0;
+  for (int shift = 0; ; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint32_t)(b & 0x7f) << shift;
+    if (b < 0x80) return v;
+  }
+}
+
+// small negative deltas must stay small once encoded
+static inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// Vertices of a building are contiguous and close to each other, as are its indices,
+// so deltas from the previous element mostly fit in a byte
+void compress_mesh(EarcutMesh& mesh) {
+  vector<uint8_t> out;
+  out.reserve(mesh.cpu_bytes() / 2);
+  put_varint(out, mesh.vertices.size());
+  put_varint(out, mesh.positions.size());
+  put_varint(out, mesh.indices.size());
+
+  auto put_positions = [&out](auto& vertices) {
+    int32_t prev[3] = {0, 0, 0};
+    for (const auto& v : vertices) {
+      for (int k = 0; k < 3; ++k) {
+        put_varint(out, zigzag(v.position[k] - prev[k]));
+        prev[k] = v.position[k];
+      }
+    }
+  };
+  put_positions(mesh.vertices);
+  put_positions(mesh.positions);
+  for (const PackedVertex& v : mesh.vertices) {
+    out.push_back((uint8_t)v.normal[0]);
+    out.push_back((uint8_t)v.normal[1]);
+  }
+  // one class per building, stored as runs
+  auto put_features = [&out](auto& vertices) {
+    for (size_t i = 0; i < vertices.size();) {
+      size_t run = 1;
+      while (i + run < vertices.size() && vertices[i + run].feature == vertices[i].feature) ++run;
+      put_varint(out, run);
+      out.push_back(vertices[i].feature);
+      i += run;
+    }
+  };
+  put_features(mesh.vertices);
+  put_features(mesh.positions);
+  int32_t prev = 0;
+  for (uint16_t idx : mesh.indices) {
+    put_varint(out, zigzag(idx - prev));
+    prev = idx;
+  }
+
+  out.shrink_to_fit();
+  mesh.compressed = std::move(out);
+  mesh.vertices = {};
+  mesh.positions = {};
+  mesh.indices = {};
+}
+
+void decompress_mesh(EarcutMesh& mesh) {
+  if (mesh.compressed.empty()) return;
+
+  const uint8_t* p = mesh.compressed.data();
+  mesh.vertices.resize(get_varint(p));
+  mesh.positions.resize(get_varint(p));
+  mesh.indices.resize(get_varint(p));
+
+  auto get_positions = [&p](auto& vertices) {
+    int32_t prev[3] = {0, 0, 0};
+    for (auto& v : vertices) {
+      for (int k = 0; k < 3; ++k) {
+        prev[k] += unzigzag(get_varint(p));
+        v.position[k] = (int16_t)prev[k];
+      }
+    }
   };
+  get_positions(mesh.vertices);
+  get_positions(mesh.positions);
+  for (PackedVertex& v : mesh.vertices) {
+    v.normal[0] = (int8_t)*p++;
+    v.normal[1] = (int8_t)*p++;
+  }
+  auto get_features = [&p](auto& vertices) {
+    for (size_t i = 0; i < vertices.size();) {
+      size_t run = get_varint(p);
+      uint8_t feature = *p++;
+      for (size_t end = i + run; i < end; ++i) vertices[i].feature = feature;
+    }
+  };
+  get_features(mesh.vertices);
+  get_features(mesh.positions);
+  int32_t prev = 0;
+  for (uint16_t& idx : mesh.indices) {
+    prev += unzigzag(get_varint(p));
+    idx = (uint16_t)prev;
+  }
 
-  auto mesh_transform = earcuts | views::transform(build_and_upload_single);
-  return vector<EarcutMesh>(mesh_transform.begin(), mesh_transform.end());
+  mesh.compressed = {};
 }
@@ -0,0 +1,78 @@
+#include "frustum.hpp"
+#include <cmath>
+#include "simd.hpp"
+
+using namespace std;
+
+static Vector4 normalize_plane(float a, float b, float c, float d) {
+  float len = sqrtf(a*a + b*b + c*c);
+  return Vector4 {a / len, b / len, c / len, d / len};
+}
+
+// Gribb & Hartmann: the planes are sums and differences of the rows of the matrix
+Frustum make_frustum(Matrix m) {
+  float r0[4] = {m.m0, m.m4, m.m8, m.m12};
+  float r1[4] = {m.m1, m.m5, m.m9, m.m13};
+  float r2[4] = {m.m2, m.m6, m.m10, m.m14};
+  float r3[4] = {m.m3, m.m7, m.m11, m.m15};
+
+  Frustum f {};
+  const float* rows[3] = {r0, r1, r2};
+  for (int i = 0; i < 3; ++i) {
+    const float* r = rows[i];
+    f.planes[2*i+0] = normalize_plane(r3[0] + r[0], r3[1] + r[1], r3[2] + r[2], r3[3] + r[3]);
+    f.planes[2*i+1] = normalize_plane(r3[0] - r[0], r3[1] - r[1], r3[2] - r[2], r3[3] - r[3]);
+  }
+  return f;
+}
+
+// The box is outside as soon as its corner farthest along a plane's normal is behind it,
+// and inside when even the nearest corner is in front of all of them
+Containment box_in_frustum(const Frustum& frustum, const BoundingBox& box) {
+  if (box.min.x > box.max.x) return Containment::Outside;
+
+  Containment result = Containment::Inside;
+  for (const Vector4& p : frustum.planes) {
+    float far_x = p.x >= 0.f ? box.max.x : box.min.x;
+    float far_y = p.y >= 0.f ? box.max.y : box.min.y;
+    float far_z = p.z >= 0.f ? box.max.z : box.min.z;
+    if (p.x*far_x + p.y*far_y + p.z*far_z + p.w < 0.f) return Containment::Outside;
+
+    float near_x = p.x >= 0.f ? box.min.x : box.max.x;
+    float near_y = p.y >= 0.f ? box.min.y : box.max.y;
+    float near_z = p.z >= 0.f ? box.min.z : box.max.z;
+    if (p.x*near_x + p.y*near_y + p.z*near_z + p.w < 0.f) result = Containment::Intersects;
+  }
+  return result;
+}
+
+void boxes_in_frustum(const Frustum& frustum, span<const BoundingBox> boxes, span<uint8_t> visible) {
+  size_t i = 0;
+#ifdef HAS_SIMD
+  // 4 boxes per iteration, the farthest corner is picked per plane with the sign of its normal
+  const f32x4 zero = splat4(0.f);
+  for (; i + 4 <= boxes.size(); i += 4) {
+    const BoundingBox* b = &boxes[i];
+    f32x4 min_x {b[0].min.x, b[1].min.x, b[2].min.x, b[3].min.x};
+    f32x4 min_y {b[0].min.y, b[1].min.y, b[2].min.y, b[3].min.y};
+    f32x4 min_z {b[0].min.z, b[1].min.z, b[2].min.z, b[3].min.z};
+    f32x4 max_x {b[0].max.x, b[1].max.x, b[2].max.x, b[3].max.x};
+    f32x4 max_y {b[0].max.y, b[1].max.y, b[2].max.y, b[3].max.y};
+    f32x4 max_z {b[0].max.z, b[1].max.z, b[2].max.z, b[3].max.z};
+
+    // empty boxes are never visible
+    i32x4 outside = min_x > max_x;
+    for (const Vector4& p : frustum.planes) {
+      f32x4 far_x = p.x >= 0.f ? max_x : min_x;
+      f32x4 far_y = p.y >= 0.f ? max_y : min_y;
+      f32x4 far_z = p.z >= 0.f ? max_z : min_z;
+      f32x4 d = splat4(p.x) * far_x + splat4(p.y) * far_y + splat4(p.z) * far_z + splat4(p.w);
+      outside |= d < zero;
+    }
+    for (int k = 0; k < 4; ++k) visible[i+k] = outside[k] == 0;
+  }
+#endif
+  for (; i < boxes.size(); ++i) {
+    visible[i] = box_in_frustum(frustum, boxes[i]) != Containment::Outside;
+  }
+}
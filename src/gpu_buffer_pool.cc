@@ -0,0 +1,163 @@
+#include "gpu_buffer_pool.hpp"
+#include <bit>
+#include <cstddef>
+#include <algorithm>
+#include "rlgl.h"
+#include "stats.hpp"
+#include "types/roads.hpp"
+
+using namespace std;
+
+// GL data types rlgl doesn't define
+#ifndef RL_BYTE
+#define RL_BYTE 0x1400
+#endif
+#ifndef RL_SHORT
+#define RL_SHORT 0x1402
+#endif
+
+// smallest bucket, below it buckets would only add slabs nobody reuses
+static const int MIN_SLAB_BYTES = 4096;
+
+static int bucket_capacity(int bytes) {
+  if (bytes == 0) return 0;
+  return bit_ceil((unsigned)max(bytes, MIN_SLAB_BYTES));
+}
+
+static int layout_stride(VertexLayout layout) {
+  switch (layout) {
+    case VertexLayout::Packed:
+    return sizeof(PackedVertex);
+    case VertexLayout::PackedPosition:
+    return sizeof(PackedPosition);
+    case VertexLayout::Road:
+    default:
+    return sizeof(RoadVertex);
+  }
+}
+
+static size_t slab_bytes(const GpuMesh& slab) {
+  return slab.vertex_capacity + slab.index_capacity;
+}
+
+GpuBufferPool::GpuBufferPool(size_t max_free_bytes):
+  m {.max_free_bytes = max_free_bytes}
+{}
+
+GpuMesh GpuBufferPool::acquire(const void* vertices, int vertices_bytes, VertexLayout layout, span<const uint16_t> indices) {
+  int index_bytes = indices.size_bytes();
+  Bucket bucket {layout, bucket_capacity(vertices_bytes), bucket_capacity(index_bytes)};
+
+  GpuMesh mesh {};
+  auto it = m.free_slabs.find(bucket);
+  if (it != m.free_slabs.end() && !it->second.empty()) {
+    mesh = it->second.back();
+    it->second.pop_back();
+    m.free_bytes -= slab_bytes(mesh);
+    ++stats().gpu_pool_reuses;
+  } else {
+    mesh = allocate_slab(get<1>(bucket), get<2>(bucket), layout);
+  }
+
+  // the element buffer is bound to the VAO, binding it with another VAO active would rebind that one's
+  rlEnableVertexArray(mesh.vao);
+  rlUpdateVertexBuffer(mesh.vbo, vertices, vertices_bytes, 0);
+  if (index_bytes > 0) rlUpdateVertexBufferElements(mesh.ebo, indices.data(), index_bytes, 0);
+  rlDisableVertexArray();
+
+  mesh.index_count = indices.size();
+  mesh.vertex_count = vertices_bytes / layout_stride(layout);
+  mesh.used_bytes = vertices_bytes + index_bytes;
+  m.used_bytes += mesh.used_bytes;
+  update_stats();
+  return mesh;
+}
+
+void GpuBufferPool::release(GpuMesh& mesh) {
+  if (mesh.vao == 0) return;
+
+  m.used_bytes -= mesh.used_bytes;
+  if (m.free_bytes + slab_bytes(mesh) > m.max_free_bytes) {
+    free_slab(mesh);
+  } else {
+    m.free_bytes += slab_bytes(mesh);
+    m.free_slabs[{mesh.layout, mesh.vertex_capacity, mesh.index_capacity}].push_back(mesh);
+  }
+
+  mesh = GpuMesh {};
+  update_stats();
+}
+
+void GpuBufferPool::trim() {
+  for (auto& [bucket, slabs] : m.free_slabs) {
+    for (GpuMesh& slab : slabs) {
+      m.free_bytes -= slab_bytes(slab);
+      free_slab(slab);
+    }
+  }
+  m.free_slabs.clear();
+  update_stats();
+}
+
+// PackedPosition is a prefix of PackedVertex, both layouts share the position attribute
+GpuMesh GpuBufferPool::allocate_slab(int vertex_capacity, int index_capacity, VertexLayout layout) {
+  GpuMesh slab {};
+  slab.vertex_capacity = vertex_capacity;
+  slab.index_capacity = index_capacity;
+  slab.layout = layout;
+  int stride = layout_stride(layout);
+
+  slab.vao = rlLoadVertexArray();
+  rlEnableVertexArray(slab.vao);
+
+  slab.vbo = rlLoadVertexBuffer(nullptr, vertex_capacity, true);
+  if (layout == VertexLayout::Road) {
+    rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 3, RL_FLOAT, false, stride, offsetof(RoadVertex, position));
+    rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
+    rlSetVertexAttribute(FEATURE_ATTRIB_LOCATION, 1, RL_UNSIGNED_BYTE, false, stride, offsetof(RoadVertex, feature));
+    rlEnableVertexAttribute(FEATURE_ATTRIB_LOCATION);
+  } else {
+    // positions are fed as raw integers, the chunk's scale lives in the model matrix
+    rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 3, RL_SHORT, false, stride, offsetof(PackedVertex, position));
+    rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
+    int feature_offset = layout == VertexLayout::Packed ? offsetof(PackedVertex, feature) : offsetof(PackedPosition, feature);
+    rlSetVertexAttribute(FEATURE_ATTRIB_LOCATION, 1, RL_UNSIGNED_BYTE, false, stride, feature_offset);
+    rlEnableVertexAttribute(FEATURE_ATTRIB_LOCATION);
+  }
+  if (layout == VertexLayout::Packed) {
+    rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_NORMAL, 2, RL_BYTE, true, stride, offsetof(PackedVertex, normal));
+    rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_NORMAL);
+  }
+
+  if (index_capacity > 0) slab.ebo = rlLoadVertexBufferElement(nullptr, index_capacity, true);
+
+  rlDisableVertexArray();
+
+  ++m.slabs;
+  m.capacity_bytes += slab_bytes(slab);
+  ++stats().gpu_pool_allocations;
+  return slab;
+}
+
+void GpuBufferPool::free_slab(GpuMesh& slab) {
+  rlUnloadVertexBuffer(slab.vbo);
+  if (slab.ebo != 0) rlUnloadVertexBuffer(slab.ebo);
+  rlUnloadVertexArray(slab.vao);
+
+  --m.slabs;
+  m.capacity_bytes -= slab_bytes(slab);
+  slab = GpuMesh {};
+}
+
+void GpuBufferPool::update_stats() const {
+  Stats& st = stats();
+  st.gpu_pool_slabs = m.slabs;
+  st.gpu_pool_capacity_bytes = m.capacity_bytes;
+  st.gpu_pool_free_bytes = m.free_bytes;
+  st.gpu_pool_used_bytes = m.used_bytes;
+}
+
+GpuBufferPool& gpu_buffer_pool() {
+  static GpuBufferPool pool {64 << 20};
+  return pool;
+}
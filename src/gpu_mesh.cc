@@ -0,0 +1,98 @@
+#include "gpu_mesh.hpp"
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include "rlgl.h"
+#include "raymath.h"
+#include "gpu_buffer_pool.hpp"
+
+using namespace std;
+
+GpuMesh upload_gpu_mesh(span<const PackedVertex> vertices, span<const uint16_t> indices) {
+  return gpu_buffer_pool().acquire(vertices.data(), vertices.size_bytes(), VertexLayout::Packed, indices);
+}
+
+GpuMesh upload_gpu_mesh(span<const PackedPosition> positions, span<const uint16_t> indices) {
+  return gpu_buffer_pool().acquire(positions.data(), positions.size_bytes(), VertexLayout::PackedPosition, indices);
+}
+
+GpuMesh upload_gpu_mesh(span<const RoadVertex> vertices) {
+  return gpu_buffer_pool().acquire(vertices.data(), vertices.size_bytes(), VertexLayout::Road, {});
+}
+
+void unload_gpu_mesh(GpuMesh& mesh) {
+  gpu_buffer_pool().release(mesh);
+}
+
+static void set_matrices(const Material& mat, Matrix transform) {
+  Matrix view = rlGetMatrixModelview();
+  Matrix projection = rlGetMatrixProjection();
+  Matrix model = MatrixMultiply(transform, rlGetMatrixTransform());
+
+  if (mat.shader.locs[SHADER_LOC_MATRIX_VIEW] != -1) rlSetUniformMatrix(mat.shader.locs[SHADER_LOC_MATRIX_VIEW], view);
+  if (mat.shader.locs[SHADER_LOC_MATRIX_PROJECTION] != -1) rlSetUniformMatrix(mat.shader.locs[SHADER_LOC_MATRIX_PROJECTION], projection);
+  if (mat.shader.locs[SHADER_LOC_MATRIX_MODEL] != -1) rlSetUniformMatrix(mat.shader.locs[SHADER_LOC_MATRIX_MODEL], model);
+  if (mat.shader.locs[SHADER_LOC_MATRIX_NORMAL] != -1) rlSetUniformMatrix(mat.shader.locs[SHADER_LOC_MATRIX_NORMAL], MatrixTranspose(MatrixInvert(model)));
+}
+
+void begin_gpu_material(const Material& mat) {
+  rlEnableShader(mat.shader.id);
+}
+
+void end_gpu_material() {
+  rlDisableShader();
+}
+
+// mostly what DrawMesh does, minus the material maps we don't use
+size_t draw_bound_gpu_mesh(const GpuMesh& mesh, const Material& mat, Matrix transform, span<const IndexRange> ranges) {
+  set_matrices(mat, transform);
+
+  rlEnableVertexArray(mesh.vao);
+  if (ranges.empty()) {
+    if (mesh.index_count > 0) rlDrawVertexArrayElements(0, mesh.index_count, 0);
+    else rlDrawVertexArray(0, mesh.vertex_count);
+  }
+  for (const IndexRange& range : ranges) {
+    if (mesh.index_count > 0) rlDrawVertexArrayElements(range.first, range.count, 0);
+    else rlDrawVertexArray(range.first, range.count);
+  }
+  rlDisableVertexArray();
+
+  return max<size_t>(ranges.size(), 1);
+}
+
+void draw_gpu_mesh(const GpuMesh& mesh, const Material& mat, Matrix transform) {
+  begin_gpu_material(mat);
+  draw_bound_gpu_mesh(mesh, mat, transform, {});
+  end_gpu_material();
+}
+
+void draw_gpu_mesh(const GpuMesh& mesh, const Material& mat, Matrix transform, span<const IndexRange> ranges) {
+  if (ranges.empty()) return;
+  begin_gpu_material(mat);
+  draw_bound_gpu_mesh(mesh, mat, transform, ranges);
+  end_gpu_material();
+}
+
+void set_palette(const Material& mat, span<const Color> colors) {
+  array<Vector4, PALETTE_SIZE> palette {};
+  for (size_t i = 0; i < min<size_t>(colors.size(), PALETTE_SIZE); ++i) 
+    palette[i] = ColorNormalize(colors[i]);
+  SetShaderValueV(mat.shader, GetShaderLocation(mat.shader, "palette"), palette.data(), SHADER_UNIFORM_VEC4, PALETTE_SIZE);
+}
+
+void oct_encode(Vector3 n, int8_t out[2]) {
+  float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  float x = n.x / l1;
+  float y = n.y / l1;
+  // the lower hemisphere is folded over the upper one
+  if (n.z < 0.f) {
+    float fx = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+    float fy = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+    x = fx;
+    y = fy;
+  }
+
+  out[0] = (int8_t)roundf(clamp(x, -1.f, 1.f) * 127.f);
+  out[1] = (int8_t)roundf(clamp(y, -1.f, 1.f) * 127.f);
+}
@@ -1,5 +1,6 @@
 #include "map_build_job.hpp"
 #include <vector>
+#include <list>
 #include <queue>
 #include <memory>
 #include <cassert>
@@ -10,9 +11,14 @@
 #include <ranges>
 #include <expected>
 #include <optional>
+#include <span>
+#include <mutex>
+#include <chrono>
 #include "curl/curl.h"
 #include "map_data.hpp"
 #include "earcut.hpp"
+#include "roads.hpp"
+#include "stats.hpp"
 
 using namespace std;
 using ExpectedJobResult = MapBuildJob::ExpectedJobResult;
@@ -21,34 +27,35 @@ using JobError = MapBuildJob::JobError;
 
 namespace views = ranges::views;
 
-MapBuildJob::MapBuildJob(): 
+MapBuildJob::MapBuildJob(MeshMode mesh_mode): 
   m {}
 {
   m.curlm = curl_multi_init();
+  m.mesh_mode = mesh_mode;
 }
 
 MapBuildJob::~MapBuildJob() {
+  // the builder is joined once this returns, it skips what is left of its queue
+  for (Build& b : m.builds)
+    b.flags->cancelled = true;
   curl_multi_cleanup(m.curlm);
 }
 
 static size_t curl_wrcb(char* ptr, size_t size, size_t nmemb, void* ud) {
   (void)size;
   string& udstr = *(static_cast<string*>(ud));
-  udstr = udstr + string(ptr, nmemb);
+  // appended in place, a chunk's response comes in many small pieces
+  udstr.append(ptr, nmemb);
   return nmemb;
 }
 
 void MapBuildJob::start(const vector<shared_ptr<Chunk>>& chunks) {
   if (chunks.size() == 0) {
-    m.state = State::Finished;
-    m.just_finished = true;
+    if (m.state != State::Working) m.state = State::Finished;
     return;
   }
 
-  m.just_finished = false;
   m.state = State::Working;
-  m.ongoing.clear();
-  m.ongoing.reserve(chunks.size());
 
   for (auto& chunk : chunks) {
     double longA = chunk->min_lon;
@@ -56,9 +63,10 @@ void MapBuildJob::start(const vector<shared_ptr<Chunk>>& chunks) {
     double longB = chunk->max_lon;
     double latB = chunk->max_lat;
     chunk->status = ChunkStatus::Generating;
+    chunk->streaming = true;
+    chunk->requested_at = chrono::steady_clock::now();
 
-    m.ongoing.push_back(OngoingJob {});
-    OngoingJob& job = m.ongoing.back();
+    OngoingJob& job = m.ongoing.emplace_back();
     job.target = chunk;
     job.curl = curl_easy_init();
     curl_easy_setopt(job.curl, CURLOPT_URL, format("https://www.openstreetmap.org/api/0.6/map?bbox={},{},{},{}", longA, latA, longB, latB).c_str());
@@ -68,45 +76,93 @@ void MapBuildJob::start(const vector<shared_ptr<Chunk>>& chunks) {
   }
 }
 
-expected<JobResult, JobError> MapBuildJob::try_build_job_result(OngoingJob& ongoing_job) {
-  string_view xml_resp = string_view(ongoing_job.data);
-  optional<MapData> md = parse_map_data(xml_resp);
+// The first batches are small so that something shows up early, they grow to keep the part count low
+static const size_t FIRST_BATCH_BUILDINGS = 128;
+static const size_t MAX_BATCH_BUILDINGS = 2048;
+
+void MapBuildJob::publish(ExpectedJobResult result) {
+  lock_guard lock(m.published_mtx);
+  m.published.push(std::move(result));
+}
+
+void MapBuildJob::build(shared_ptr<Chunk> target, string data, const BuildFlags& flags) {
+  if (flags.cancelled) return;
+  // tinyxml2 wants the whole document, parsing only starts once the download is over
+  optional<MapData> md = parse_map_data(string_view(data));
   if (!md) {
-    return unexpected(ErrorInternal {});
+    publish({target, unexpected(ErrorInternal {})});
+    return;
+  }
+
+  // roads are quick to build and make the chunk readable
+  auto roads_view = md->ways | views::filter([](const Way& w){ return w.is_highway(); });
+  vector<Way> roads(roads_view.begin(), roads_view.end());
+  RoadMesh road_mesh = build_road_mesh(roads, target->world_min, worker_pool());
+
+  vector<const Way*> buildings;
+  for (const Way& w : md->ways) {
+    if (w.is_building()) buildings.push_back(&w);
+  }
+  vector<size_t> batches = progressive_batches(buildings, FIRST_BATCH_BUILDINGS, MAX_BATCH_BUILDINGS);
+  publish({target, JobResult {
+    .road_count = roads.size(),
+    .road_mesh = std::move(road_mesh),
+    .lods = {},
+    .whole = false,
+    .last = batches.size() < 2,
+  }});
+
+  // every part is quantized and clustered like the whole chunk would be
+  MeshFrame frame = fit_mesh_frame(buildings, target->world_min);
+  // a single batch is the whole chunk already
+  bool single = batches.size() == 2;
+  EarcutBatch whole;
+  for (size_t b = 0; b + 1 < batches.size(); ++b) {
+    // the chunk was retired, the rest of its parts would be dropped
+    if (flags.cancelled) return;
+    span<const Way* const> batch_buildings = span(buildings).subspan(batches[b], batches[b+1] - batches[b]);
+    EarcutBatch batch = earcut_buildings(batch_buildings, m.mesh_mode, worker_pool());
+    publish({target, JobResult {
+      .road_count = 0,
+      .road_mesh = {},
+      .lods = build_lod_meshes(batch, target->world_min, m.mesh_mode, worker_pool(), frame, single),
+      .whole = false,
+      .last = single,
+    }});
+    if (!single) append_batch(whole, batch);
   }
 
-  return JobResult {
-    .roads = [&md]() {
-      auto roads_view = md->ways | views::filter([](const Way& w){ return w.is_highway(); });
-      return vector<Way>(roads_view.begin(), roads_view.end());
-    }(),
-    .meshes = [&md](){ 
-      auto buildings = md->ways | views::filter([](const Way& w){ return w.is_building(); });
-      vector<EarcutResult> earcuts = earcut_collection(std::move(buildings));
-      return build_meshes(earcuts);
-    }()
-  };
+  // each part brought meshes of its own, the whole chunk's replace them: fewer draw calls and culling
+  // work for as long as it's loaded. The batches are in building order, no need to triangulate again
+  if (batches.size() <= 2 || flags.cancelled) return;
+  publish({target, JobResult {
+    .road_count = 0,
+    .road_mesh = {},
+    .lods = build_lod_meshes(whole, target->world_min, m.mesh_mode, worker_pool(), frame),
+    .whole = true,
+    .last = true,
+  }});
 }
 
-queue<ExpectedJobResult> MapBuildJob::poll() {
-  if (m.just_finished) {
-    m.just_finished = false;
+void MapBuildJob::cancel(const shared_ptr<Chunk>& chunk) {
+  for (Build& b : m.builds) {
+    if (b.target == chunk) b.flags->cancelled = true;
   }
 
+  auto job = ranges::find(m.ongoing, chunk, &OngoingJob::target);
+  if (job == m.ongoing.end()) return;
+  curl_multi_remove_handle(m.curlm, job->curl);
+  curl_easy_cleanup(job->curl);
+  m.ongoing.erase(job);
+}
+
+queue<ExpectedJobResult> MapBuildJob::poll() {
   if (m.state == State::Finished || m.state == State::AwaitingStart) return {};
   curl_multi_poll(m.curlm, NULL, 0, 0, NULL);
 
   int running_handles;
   curl_multi_perform(m.curlm, &running_handles);
 
-  // whilst they are not running, they might need to be processed
-  // let's not be hasty into returning earlier than needed
-  if (running_handles == 0) {
-    m.state = State::Finished;
-  }
-
-  queue<ExpectedJobResult> results {};
-
   CURLMsg* msg;
   int num_msgs;
   while (msg = curl_multi_info_read(m.curlm, &num_msgs), msg) {
@@ -120,7 +176,7 @@ queue<ExpectedJobResult> MapBuildJob::poll() {
           long code;
           curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
           if (code >= 400) {
-            results.push(ExpectedJobResult {
+            publish(ExpectedJobResult {
               ongoing_job->target,
               unexpected(ErrorHttp {
                 code,
@@ -128,15 +184,20 @@ queue<ExpectedJobResult> MapBuildJob::poll() {
               })
             });
           } else {
-            results.push({
-              ongoing_job->target,
-              try_build_job_result(*ongoing_job)
-            });  
+            ongoing_job->target->downloaded_at = chrono::steady_clock::now();
+            stats().download_ns += chrono::duration_cast<chrono::nanoseconds>(ongoing_job->target->downloaded_at - ongoing_job->target->requested_at).count();
+            ++stats().download_chunks;
+            auto flags = make_shared<BuildFlags>();
+            m.builds.push_back(Build {ongoing_job->target, flags});
+            m.builder.submit([this, target = ongoing_job->target, data = std::move(ongoing_job->data), flags]() mutable {
+              build(std::move(target), std::move(data), *flags);
+              flags->done = true;
+            });
           }
           
           curl_multi_remove_handle(m.curlm, ongoing_job->curl);
           curl_easy_cleanup(ongoing_job->curl);
-          ongoing_job->done = true;
+          m.ongoing.erase(ongoing_job);
         }
         break;
       default:
@@ -144,10 +205,16 @@ queue<ExpectedJobResult> MapBuildJob::poll() {
     } 
   } 
 
-  if (running_handles == 0) {
-    m.ongoing.clear();
-    m.just_finished = true;
+  // pruned before taking the parts, the builds seen done have published everything
+  erase_if(m.builds, [](const Build& b) { return b.flags->done.load(); });
+  bool built = m.builds.empty();
+  queue<ExpectedJobResult> results {};
+  {
+    lock_guard lock(m.published_mtx);
+    swap(results, m.published);
   }
 
+  if (running_handles == 0 && built) m.state = State::Finished;
+
   return results;
 }
@@ -0,0 +1,181 @@
+#include "occlusion.hpp"
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include "simd.hpp"
+
+using namespace std;
+
+// Vector and scalar kernels must round the same way, no fused multiply-add
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+// Corner i of a box takes max on x, y and z when bits 0, 1 and 2 are set.
+// Each face lists its corners counter clockwise seen from outside the box
+static const int BOX_FACES[6][4] = {
+  {0, 4, 6, 2}, // -x
+  {5, 1, 3, 7}, // +x
+  {0, 1, 5, 4}, // -y
+  {3, 2, 6, 7}, // +y
+  {1, 0, 2, 3}, // -z
+  {4, 5, 7, 6}, // +z
+};
+
+OcclusionBuffer::OcclusionBuffer(int width, int height): m() {
+  assert(width % 4 == 0);
+  m.width = width;
+  m.height = height;
+  m.depth.assign(width * height, 0.f);
+}
+
+void OcclusionBuffer::clear(Matrix view_projection) {
+  m.view_projection = view_projection;
+  ranges::fill(m.depth, 0.f);
+}
+
+bool OcclusionBuffer::project_box(const BoundingBox& box, Corner corners[8]) const {
+  const Matrix& vp = m.view_projection;
+  for (int i = 0; i < 8; ++i) {
+    float px = i & 1 ? box.max.x : box.min.x;
+    float py = i & 2 ? box.max.y : box.min.y;
+    float pz = i & 4 ? box.max.z : box.min.z;
+    float x = vp.m0*px + vp.m4*py + vp.m8*pz + vp.m12;
+    float y = vp.m1*px + vp.m5*py + vp.m9*pz + vp.m13;
+    float z = vp.m2*px + vp.m6*py + vp.m10*pz + vp.m14;
+    float w = vp.m3*px + vp.m7*py + vp.m11*pz + vp.m15;
+    if (w <= 0.f || z < -w) return false;
+
+    // to pixels, y going down
+    float inv_w = 1.f / w;
+    corners[i] = Corner {
+      .x = (x * inv_w * .5f + .5f) * m.width,
+      .y = (.5f - y * inv_w * .5f) * m.height,
+      .inv_w = inv_w,
+    };
+  }
+  return true;
+}
+
+// Covers the pixels entirely inside the quad with the depth of its farthest corner,
+// the quad is nearer everywhere on them so nothing behind it can be wrongly hidden
+void OcclusionBuffer::rasterize_quad(const Corner& a, const Corner& b, const Corner& c, const Corner& d) {
+  const Corner* quad[4] = {&a, &b, &c, &d};
+
+  // counter clockwise from outside becomes clockwise once y points down, the other way around is a back face
+  float double_area = 0.f;
+  for (int i = 0; i < 4; ++i) {
+    const Corner& p = *quad[i];
+    const Corner& q = *quad[(i+1)%4];
+    double_area += p.x * q.y - q.x * p.y;
+  }
+  if (double_area >= 0.f) return;
+
+  // edge functions e(x, y) = ex*x + ey*y + e0 at pixel centers, positive when the whole pixel is inside
+  float ex[4], ey[4], e0[4];
+  float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+  float depth = INFINITY;
+  for (int i = 0; i < 4; ++i) {
+    const Corner& p = *quad[i];
+    const Corner& q = *quad[(i+1)%4];
+    ex[i] = q.y - p.y;
+    ey[i] = p.x - q.x;
+    e0[i] = -(ex[i] * p.x + ey[i] * p.y) - .5f * (fabsf(ex[i]) + fabsf(ey[i]));
+    min_x = min(min_x, p.x);
+    min_y = min(min_y, p.y);
+    max_x = max(max_x, p.x);
+    max_y = max(max_y, p.y);
+    depth = min(depth, p.inv_w);
+  }
+
+  int x0 = max(0, (int)floorf(min_x));
+  int y0 = max(0, (int)floorf(min_y));
+  int x1 = min(m.width - 1, (int)floorf(max_x));
+  int y1 = min(m.height - 1, (int)floorf(max_y));
+  if (x0 > x1 || y0 > y1) return;
+
+  for (int y = y0; y <= y1; ++y) {
+    float py = y + .5f;
+    float row[4];
+    for (int i = 0; i < 4; ++i) row[i] = ey[i] * py + e0[i];
+    float* line = &m.depth[y * m.width];
+
+    int x = x0;
+#ifdef HAS_SIMD
+    // blocks of 4 pixels aligned on the row, pixels past x1 are outside the quad's bounds and fail the edge tests
+    const f32x4 zero = splat4(0.f), d = splat4(depth), lanes {.5f, 1.5f, 2.5f, 3.5f};
+    for (x = x0 & ~3; x <= x1; x += 4) {
+      f32x4 px = splat4((float)x) + lanes;
+      i32x4 inside = splat4_i(-1);
+      for (int i = 0; i < 4; ++i) {
+        inside &= splat4(ex[i]) * px + splat4(row[i]) >= zero;
+      }
+      if (!any4(inside)) continue;
+      f32x4 current = load4(line + x);
+      store4(line + x, select4(inside & (d > current), d, current));
+    }
+#endif
+    for (; x <= x1; ++x) {
+      float px = x + .5f;
+      bool inside = true;
+      for (int i = 0; i < 4; ++i) {
+        inside &= ex[i] * px + row[i] >= 0.f;
+      }
+      if (inside && depth > line[x]) line[x] = depth;
+    }
+  }
+}
+
+void OcclusionBuffer::add_occluder(const BoundingBox& box) {
+  if (box.min.x > box.max.x) return;
+
+  Corner corners[8];
+  if (!project_box(box, corners)) return;
+  for (const auto& face : BOX_FACES) {
+    rasterize_quad(corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]]);
+  }
+}
+
+// Tested against the screen rectangle of the box with the depth of its nearest corner.
+// An occluder exactly as near doesn't hide it
+bool OcclusionBuffer::is_visible(const BoundingBox& box) const {
+  if (box.min.x > box.max.x) return false;
+
+  Corner corners[8];
+  if (!project_box(box, corners)) return true;
+
+  float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+  float nearest = 0.f;
+  for (const Corner& c : corners) {
+    min_x = min(min_x, c.x);
+    min_y = min(min_y, c.y);
+    max_x = max(max_x, c.x);
+    max_y = max(max_y, c.y);
+    nearest = max(nearest, c.inv_w);
+  }
+
+  int x0 = max(0, (int)floorf(min_x));
+  int y0 = max(0, (int)floorf(min_y));
+  int x1 = min(m.width - 1, (int)floorf(max_x));
+  int y1 = min(m.height - 1, (int)floorf(max_y));
+  // off screen
+  if (x0 > x1 || y0 > y1) return false;
+
+  for (int y = y0; y <= y1; ++y) {
+    const float* line = &m.depth[y * m.width];
+    int x = x0;
+#ifdef HAS_SIMD
+    const f32x4 n = splat4(nearest);
+    const i32x4 lanes {0, 1, 2, 3};
+    for (x = x0 & ~3; x <= x1; x += 4) {
+      i32x4 px = splat4_i(x) + lanes;
+      i32x4 in_range = (px >= splat4_i(x0)) & (px <= splat4_i(x1));
+      if (any4(in_range & (load4(line + x) <= n))) return true;
+    }
+#endif
+    for (; x <= x1; ++x) {
+      if (line[x] <= nearest) return true;
+    }
+  }
+  return false;
+}
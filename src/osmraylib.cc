@@ -11,10 +11,24 @@
 #include <array>
 #include <memory>
 #include <variant>
+#include <algorithm>
+#include <chrono>
 #include "map_data.hpp"
 #include "earcut.hpp"
+#include "gpu_mesh.hpp"
 #include "chunk.hpp"
 #include "map_build_job.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "upload_queue.hpp"
+#include "gpu_buffer_pool.hpp"
+#include "frustum.hpp"
+#include "occlusion.hpp"
+#include "render_queue.hpp"
+#include "debug_overlay.hpp"
+#include "roads.hpp"
+#include "chunk_streamer.hpp"
+#include "chunk_cache.hpp"
 
 using namespace std;
 
@@ -23,38 +37,78 @@ const double LONG_A = 2.25797;
 const double LAT_A  = 48.61416;
 const double LONG_B = 2.26037;
 const double LAT_B  = 48.61511;
-shared_ptr<Chunk> start_chunk;
-vector<shared_ptr<Chunk>> chunks;
+// DerivedNormals drops the normal stream from the meshes, the fragment shader computes them instead
+const MeshMode MESH_MODE = MeshMode::Normals;
+// what chunks keep of their meshes in RAM once uploaded. With a copy, the cache can drop the GPU side
+// of the chunks out of range and upload them again later instead of rebuilding them
+const MeshRetention MESH_RETENTION = MeshRetention::Compressed;
+// GPU uploads of finished chunks allowed per frame
+const UploadQueue::Budget UPLOAD_BUDGET = {.max_ms = 2.0, .max_bytes = 4 << 20};
+// software depth buffer for occlusion culling, its height follows the window's aspect ratio
+const int OCCLUSION_WIDTH = 256;
+// chunks closest to the camera whose buildings are rasterized as occluders
+const size_t MAX_OCCLUDER_CHUNKS = 4;
+// past this many ranges a mesh is drawn whole, draw calls would cost more than the hidden triangles
+const size_t MAX_RANGES_PER_MESH = 32;
+// a chunk is drawn at the coarsest detail level whose geometric error covers at most this many pixels
+const float MAX_SCREEN_ERROR = 2.f;
+// chunks around the camera, in world units: a chunk is about 18 x 11
+const ChunkStreamer::Config STREAMING = {.load_radius = 25.f, .unload_radius = 35.f, .max_requests = 2};
+// mesh bytes of the loaded and cached chunks
+const ChunkCache::Budget CACHE_BUDGET = {.cpu_bytes = 64 << 20, .gpu_bytes = 256 << 20};
 
-Material initialize_mat() {
+Material initialize_mat(MeshMode mesh_mode) {
   Shader shader = LoadShader("resources/shaders/flat_shade.vs", "resources/shaders/flat_shade.fs");
 
   Material mat = Material {
     .shader = shader,
     .maps = (MaterialMap*)RL_CALLOC(12, sizeof(MaterialMap)),
   };
-  mat.maps[MATERIAL_MAP_ALBEDO].color = DARKPURPLE;
-
   mat.shader.locs[SHADER_LOC_MATRIX_VIEW] = GetShaderLocation(mat.shader, "matView");
   mat.shader.locs[SHADER_LOC_MATRIX_PROJECTION] = GetShaderLocation(mat.shader, "matProjection");
   mat.shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(mat.shader, "matModel");
   mat.shader.locs[SHADER_LOC_MATRIX_NORMAL] = GetShaderLocation(mat.shader, "matNormal");
 
   mat.shader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(mat.shader, "viewPos");
-  mat.shader.locs[SHADER_LOC_MAP_ALBEDO] = GetShaderLocation(mat.shader, "albedoColor");
 
-  Vector4 albedo_norm = ColorNormalize(mat.maps[MATERIAL_MAP_ALBEDO].color);
-  SetShaderValue(
-    mat.shader, 
-    mat.shader.locs[SHADER_LOC_MAP_ALBEDO], 
-    &albedo_norm,
-    SHADER_UNIFORM_VEC4
-  );
+  int derived_normals = mesh_mode == MeshMode::DerivedNormals;
+  SetShaderValue(mat.shader, GetShaderLocation(mat.shader, "derivedNormals"), &derived_normals, SHADER_UNIFORM_INT);
+
+  // every building class stays in the same meshes, they only differ by their palette entry
+  array<Color, PALETTE_SIZE> palette {};
+  for (int c = 0; c <= (int)BuildingClass::Public; ++c) 
+    palette[c] = building_color((BuildingClass)c);
+  set_palette(mat, palette);
 
   return mat;
 }
 
-void poll_build_job_results(MapBuildJob& build_job) {
+Material initialize_road_mat() {
+  Shader shader = LoadShader("resources/shaders/road.vs", "resources/shaders/road.fs");
+
+  Material mat = Material {
+    .shader = shader,
+    .maps = (MaterialMap*)RL_CALLOC(12, sizeof(MaterialMap)),
+  };
+
+  mat.shader.locs[SHADER_LOC_MATRIX_VIEW] = GetShaderLocation(mat.shader, "matView");
+  mat.shader.locs[SHADER_LOC_MATRIX_PROJECTION] = GetShaderLocation(mat.shader, "matProjection");
+  mat.shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(mat.shader, "matModel");
+
+  array<Color, PALETTE_SIZE> palette {};
+  for (int c = 0; c <= (int)RoadClass::Path; ++c) 
+    palette[c] = road_color((RoadClass)c);
+  set_palette(mat, palette);
+
+  return mat;
+}
+
+// A failed chunk goes back to Pending and is requested again after a delay doubling with each
+// failure, the OSM API answers too many requests with errors. It is left Invalid after the last one
+static const unsigned MAX_BUILD_FAILURES = 4;
+static const chrono::seconds FIRST_RETRY_DELAY {2};
+
+void poll_build_job_results(MapBuildJob& build_job, UploadQueue& upload_queue) {
   queue<MapBuildJob::ExpectedJobResult> results = build_job.poll();
 
   while(!results.empty()) {
@@ -62,18 +116,38 @@ void poll_build_job_results(MapBuildJob& build_job) {
 
     // handle potential error
     if (!res.result.has_value()) {
-      res.target->status = ChunkStatus::Invalid;
+      Chunk& chunk = *res.target;
       MapBuildJob::JobError err = res.result.error();
-      if (auto* internal = get_if<MapBuildJob::ErrorInternal>(&err)) {
-        (void)internal;
-      } else
       if (auto* http = get_if<MapBuildJob::ErrorHttp>(&err)) {
-        (void)http;
+        TraceLog(LOG_WARNING, "CHUNK: [%f, %f] download failed, HTTP %ld: %s", chunk.min_lon, chunk.min_lat, http->code, 
+          http->msg.c_str());
+      } else {
+        TraceLog(LOG_WARNING, "CHUNK: [%f, %f] map data could not be parsed", chunk.min_lon, chunk.min_lat);
       }
-    } else {
-      res.target->upload_roads(std::move(res.result->roads));
-      res.target->upload_meshes(std::move(res.result->meshes));
-      res.target->status = ChunkStatus::Generated;
+
+      ++chunk.failed_builds;
+      chunk.streaming = false;
+      if (chunk.failed_builds < MAX_BUILD_FAILURES) {
+        chrono::seconds delay = FIRST_RETRY_DELAY * (1 << (chunk.failed_builds - 1));
+        chunk.status = ChunkStatus::Pending;
+        chunk.retry_at = chrono::steady_clock::now() + delay;
+        TraceLog(LOG_INFO, "CHUNK: [%f, %f] retried in %llds", chunk.min_lon, chunk.min_lat, (long long)delay.count());
+      } else {
+        chunk.status = ChunkStatus::Invalid;
+        TraceLog(LOG_ERROR, "CHUNK: [%f, %f] given up after %u failed builds", chunk.min_lon, chunk.min_lat, chunk.failed_builds);
+      }
+    } else if (res.target->status == ChunkStatus::Generating) {
+      // chunks are shown part by part, as they are built. Parts of unloaded chunks are dropped
+      MapBuildJob::JobResult& part = *res.result;
+      res.target->failed_builds = 0;
+      if (part.road_count > 0) res.target->set_roads(std::move(part.road_mesh), part.road_count);
+      if (part.whole) {
+        res.target->replace_meshes(std::move(part.lods));
+      } else if (!part.lods.empty()) {
+        res.target->add_meshes(std::move(part.lods));
+      }
+      res.target->streaming = !part.last;
+      upload_queue.push(res.target);
     }
 
 
@@ -81,6 +155,113 @@ void poll_build_job_results(MapBuildJob& build_job) {
   }
 }
 
+float distance_to_box(Vector3 p, const BoundingBox& box) {
+  Vector3 closest = Vector3Min(Vector3Max(p, box.min), box.max);
+  return Vector3Distance(p, closest);
+}
+
+// pixels_per_unit is the size on screen of one world unit at a distance of one.
+// The chosen level may not be uploaded yet, the nearest uploaded one is used instead, finer ones first
+size_t select_lod(const Chunk& chunk, float distance, float pixels_per_unit) {
+  size_t wanted = 0;
+  for (size_t lod = 1; lod < chunk.lod_count(); ++lod) {
+    if (chunk.lod_error(lod) * pixels_per_unit / max(distance, 1e-3f) <= MAX_SCREEN_ERROR) wanted = lod;
+  }
+
+  for (size_t lod = wanted + 1; lod-- > 0;) {
+    if (chunk.lod_uploaded(lod)) return lod;
+  }
+  for (size_t lod = wanted + 1; lod < chunk.lod_count(); ++lod) {
+    if (chunk.lod_uploaded(lod)) return lod;
+  }
+  return wanted;
+}
+
+// Coarsest road level whose simplification stays under MAX_SCREEN_ERROR, all the levels are uploaded at once
+const RoadLod& select_road_lod(const RoadMesh& mesh, float distance, float pixels_per_unit) {
+  size_t lod = 0;
+  for (size_t l = 1; l < mesh.lods.size(); ++l) {
+    if (mesh.lods[l].tolerance * pixels_per_unit / max(distance, 1e-3f) <= MAX_SCREEN_ERROR) lod = l;
+  }
+  return mesh.lods[lod];
+}
+
+// Culling results of a chunk for the current frame, sized after the uploaded meshes of its detail level
+struct ChunkVisibility {
+  Containment containment = Containment::Outside;
+  size_t lod = 0;
+  // frustum test of each mesh
+  vector<uint8_t> meshes;
+  // what is left to draw of each visible mesh once its buildings went through the frustum and occlusion tests
+  vector<vector<IndexRange>> ranges;
+};
+
+struct OcclusionResult {
+  int buildings = 0;
+  int buildings_occluded = 0;
+};
+
+// Rasterizes the buildings of the chunks nearest to the camera, then tests the buildings of the meshes
+// left by the frustum test against them. Only reads the chunks, it runs on its own thread.
+// Occluders come from full detail chunks only, the coarser levels may not cover the actual footprints
+OcclusionResult cull_buildings(OcclusionBuffer& buffer, Matrix view_projection, const Frustum& frustum, Vector3 camera,
+  const vector<shared_ptr<Chunk>>& chunks, vector<ChunkVisibility>& visibility) {
+  buffer.clear(view_projection);
+
+  vector<size_t> nearest;
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    if (visibility[c].containment != Containment::Outside && visibility[c].lod == 0) nearest.push_back(c);
+  }
+  ranges::sort(nearest, {}, [&](size_t c) { return distance_to_box(camera, chunks[c]->bounds()); });
+  nearest.resize(min(nearest.size(), MAX_OCCLUDER_CHUNKS));
+
+  for (size_t c : nearest) {
+    auto meshes = chunks[c]->meshes();
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      if (!visibility[c].meshes[i]) continue;
+      for (const BoundingBox& occluder : meshes[i].buildings.occluders) 
+        buffer.add_occluder(occluder);
+    }
+  }
+
+  OcclusionResult result;
+  vector<uint8_t> visible_buildings;
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    ChunkVisibility& v = visibility[c];
+    if (v.containment == Containment::Outside) continue;
+
+    auto meshes = chunks[c]->meshes(v.lod);
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      vector<IndexRange>& draw_ranges = v.ranges[i];
+      draw_ranges.clear();
+      if (!v.meshes[i]) continue;
+
+      const MeshBuildings& buildings = meshes[i].buildings;
+      visible_buildings.assign(buildings.bounds.size(), 1);
+      if (v.containment == Containment::Intersects) 
+        boxes_in_frustum(frustum, buildings.bounds, visible_buildings);
+
+      for (size_t b = 0; b < buildings.bounds.size(); ++b) {
+        if (!visible_buildings[b]) continue;
+        ++result.buildings;
+        if (!buffer.is_visible(buildings.bounds[b])) {
+          ++result.buildings_occluded;
+          continue;
+        }
+        // neighbours in the mesh are merged
+        const IndexRange& indices = buildings.indices[b];
+        if (!draw_ranges.empty() && draw_ranges.back().first + draw_ranges.back().count == indices.first) 
+          draw_ranges.back().count += indices.count;
+        else
+          draw_ranges.push_back(indices);
+      }
+
+      if (draw_ranges.size() > MAX_RANGES_PER_MESH) 
+        draw_ranges.assign(1, IndexRange {0, (uint32_t)meshes[i].gpu.index_count});
+    }
+  }
+  return result;
+}
 
 int main() {
   InitWindow(1000, 1000, "ZIZIMAP");
@@ -104,71 +285,100 @@ int main() {
     .projection = CAMERA_PERSPECTIVE
   };
 
-  Material mat = initialize_mat();
-  MapBuildJob build_job {};
-  bool unload_chunks_next_press = false;
-  start_chunk = make_shared<Chunk>(longA, latA, longB, latB);
-  chunks.push_back(start_chunk);
+  Material mat = initialize_mat(MESH_MODE);
+  Material road_mat = initialize_road_mat();
+  MapBuildJob build_job {MESH_MODE};
+  UploadQueue upload_queue {UPLOAD_BUDGET};
+  // occlusion culling has a thread to itself so that it never waits behind build tasks
+  ThreadPool occlusion_thread {1};
+  OcclusionBuffer occlusion_buffer {OCCLUSION_WIDTH, OCCLUSION_WIDTH * GetScreenHeight() / GetScreenWidth()};
+  // per chunk culling results, reused across frames
+  vector<ChunkVisibility> visibility;
+  RenderQueue render_queue;
+  DebugOverlay debug_overlay;
+  debug_overlay.load();
+  shared_ptr<Chunk> start_chunk = make_shared<Chunk>(longA, latA, longB, latB);
+  start_chunk->retention = MESH_RETENTION;
+  ChunkStreamer streamer {start_chunk, STREAMING};
+  ChunkCache cache {CACHE_BUDGET};
 
   while(!WindowShouldClose()) {
     UpdateCamera(&camera, CAMERA_FREE);
 
-    poll_build_job_results(build_job);
-    if (build_job.just_finished()) {
-      if (chunks.size() == 1) {
-        auto adjacents = start_chunk->generate_adjacents();
-        chunks.insert(chunks.end(), adjacents.begin(), adjacents.end());
-      } else if (chunks.size() > 1) {
-        unload_chunks_next_press = true;
-      }
-    }
+    streamer.update(camera.position, camera.target, build_job, upload_queue, cache);
+    poll_build_job_results(build_job, upload_queue);
+    upload_queue.process(Vector2 {camera.position.x, camera.position.z});
+    const vector<shared_ptr<Chunk>>& chunks = streamer.chunks();
     
-    if (IsKeyPressed(KEY_R)) {
-      if (unload_chunks_next_press) {
-        unload_chunks_next_press = false;
-        for (auto& c : chunks)
-          c->unload();
-
-        chunks.clear();
-        chunks.push_back(start_chunk);
-      } else if (!build_job.ongoing()){
-        build_job.start(chunks);
-      }
-    }
+    if (IsKeyPressed(KEY_F3)) debug_overlay.set_enabled(!debug_overlay.enabled());
 
     float cameraPos[3] = {camera.position.x, camera.position.y, camera.position.z};
     SetShaderValue(mat.shader, mat.shader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos, SHADER_UNIFORM_VEC3);
 
+    // same matrices as BeginMode3D, culling starts before drawing
+    Matrix view_projection = MatrixMultiply(
+      GetCameraViewMatrix(&camera), 
+      GetCameraProjectionMatrix(&camera, (float)GetScreenWidth() / GetScreenHeight())
+    );
+    // size on screen of a world unit one unit away from the camera
+    float pixels_per_unit = GetScreenHeight() / (2.f * tanf(camera.fovy * DEG2RAD * .5f));
+    int num_chunks_culled = 0;
+    int num_clusters = 0;
+    int num_clusters_culled = 0;
+    array<int, LOD_COUNT> num_chunks_per_lod {};
+    // chunks are tested first, then the building clusters of the chunks crossing the frustum's planes
+    Frustum frustum = make_frustum(view_projection);
+    visibility.resize(chunks.size());
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      ChunkVisibility& v = visibility[c];
+      v.lod = select_lod(*chunks[c], distance_to_box(camera.position, chunks[c]->bounds()), pixels_per_unit);
+      auto meshes = chunks[c]->meshes(v.lod);
+      num_clusters += meshes.size();
+      v.containment = box_in_frustum(frustum, chunks[c]->bounds());
+      v.meshes.assign(meshes.size(), v.containment != Containment::Outside);
+      v.ranges.resize(meshes.size());
+      if (v.containment == Containment::Intersects) 
+        boxes_in_frustum(frustum, chunks[c]->meshes_bounds(v.lod), v.meshes);
+      if (v.containment != Containment::Outside && !meshes.empty()) ++num_chunks_per_lod[v.lod];
+
+      if (v.containment == Containment::Outside) ++num_chunks_culled;
+      num_clusters_culled += ranges::count(v.meshes, 0);
+    }
+    // chunks must not change until it's done
+    OcclusionResult occlusion;
+    future<void> occlusion_done = occlusion_thread.submit([&]() {
+      occlusion = cull_buildings(occlusion_buffer, view_projection, frustum, camera.position, chunks, visibility);
+    });
+
     BeginDrawing();
       ClearBackground(RAYWHITE);
 
       BeginMode3D(camera);
         int num_chunks_loaded = 0;
-        int num_meshes = 0;
         int num_roads = 0;
-        for (const auto& chunk : chunks) {
-          for (const EarcutMesh& m : chunk->meshes()) {
-            ++num_meshes;
-            Vector2 mesh_pos = m.world_offset;
-            Matrix transform = MatrixTranslate(mesh_pos.x, 0.f, mesh_pos.y);
-            DrawMesh(m.mesh, mat, transform);
+        size_t num_road_vertices = 0;
+        size_t num_road_vertices_full = 0;
+        // roads and debug shapes are queued while the buildings go through occlusion culling
+        for (size_t c = 0; c < chunks.size(); ++c) {
+          const auto& chunk = chunks[c];
+          const RoadMesh& road_mesh = chunk->road_mesh();
+          if (visibility[c].containment != Containment::Outside && road_mesh.gpu.vao != 0 
+            && box_in_frustum(frustum, road_mesh.bounds) != Containment::Outside) {
+            float distance = distance_to_box(camera.position, road_mesh.bounds);
+            const RoadLod& lod = select_road_lod(road_mesh, distance, pixels_per_unit);
+            num_roads += chunk->road_count();
+            num_road_vertices += lod.vertices.count;
+            num_road_vertices_full += road_mesh.lods[0].vertices.count;
+            render_queue.submit(DrawItem {
+              .draw = MeshDraw {&road_mesh.gpu, &road_mat, chunk->roads_transform(), span(&lod.vertices, 1)},
+              .depth = distance,
+            });
           }
 
-          for (const Way& w : chunk->roads()) {
-            if (w.nodes.size() < 2) continue;
-            ++num_roads;
-            Vector2 pv = to2DCoords(w.nodes[0].longitude, w.nodes[0].latitude);
-            for (size_t i = 1; i < w.nodes.size(); ++i) {
-              Vector2 end = to2DCoords(w.nodes[i].longitude, w.nodes[i].latitude);
-              DrawLine3D(Vector3 {pv.x, 0.f, pv.y}, Vector3 {end.x, 0.f, end.y}, BLUE);
-              pv = end;
-            }
-          }
-
-          DrawSphere(Vector3(chunk->world_min.x, 0.f, chunk->world_min.y), .25f, Fade(RED, 0.5f));
-          DrawSphere(Vector3(chunk->world_max.x, 0.f, chunk->world_max.y), .25f, Fade(GREEN, 0.5f));
-          DrawSphere(Vector3(chunk->world_max.x, 0.f, chunk->world_min.y), .25f, Fade(BLUE, 0.5f));
-          DrawSphere(Vector3(chunk->world_min.x, 0.f, chunk->world_max.y), .25f, Fade(PURPLE, 0.5f));
+          debug_overlay.add_sphere(Vector3(chunk->world_min.x, 0.f, chunk->world_min.y), .25f, Fade(RED, 0.5f));
+          debug_overlay.add_sphere(Vector3(chunk->world_max.x, 0.f, chunk->world_max.y), .25f, Fade(GREEN, 0.5f));
+          debug_overlay.add_sphere(Vector3(chunk->world_max.x, 0.f, chunk->world_min.y), .25f, Fade(BLUE, 0.5f));
+          debug_overlay.add_sphere(Vector3(chunk->world_min.x, 0.f, chunk->world_max.y), .25f, Fade(PURPLE, 0.5f));
 
           Color plane_color;
           switch(chunk->status) {
@@ -193,18 +403,98 @@ int main() {
           Vector2 size = Vector2Subtract(chunk->world_max, chunk->world_min);
           size.x = abs(size.x);
           size.y = abs(size.y);
-          DrawPlane(Vector3(chunk->world_min.x + size.x * 0.5f, 0.f, chunk->world_min.y - size.y * 0.5f), size, plane_color);
+          debug_overlay.add_plane(Vector3(chunk->world_min.x + size.x * 0.5f, 0.f, chunk->world_min.y - size.y * 0.5f), size, plane_color);
+        }
+
+        occlusion_done.get();
+        for (size_t c = 0; c < chunks.size(); ++c) {
+          auto meshes = chunks[c]->meshes(visibility[c].lod);
+          if (meshes.empty()) continue;
+          Matrix transform = chunks[c]->meshes_transform(visibility[c].lod);
+          auto bounds = chunks[c]->meshes_bounds(visibility[c].lod);
+          for (size_t i = 0; i < meshes.size(); ++i) {
+            const vector<IndexRange>& draw_ranges = visibility[c].ranges[i];
+            if (draw_ranges.empty()) continue;
+            render_queue.submit(DrawItem {
+              .draw = MeshDraw {&meshes[i].gpu, &mat, transform, draw_ranges},
+              .depth = distance_to_box(camera.position, bounds[i]),
+            });
+          }
         }
+        render_queue.flush();
+        debug_overlay.draw(camera.position);
 
         DrawGrid(10, 1.f);
       EndMode3D();
       DrawFPS(10, 10);
-      DrawText(format("{} chunks loaded", num_chunks_loaded).c_str(), 10, 35, 20, BLUE);
-      DrawText(format("- {} meshes", num_meshes).c_str(), 15, 55, 18, BLUE);
-      DrawText(format("- {} roads", num_roads).c_str(), 15, 73, 18, BLUE);
+      const ChunkStreamer::Counters& streamed = streamer.counters();
+      DrawText(format("{} / {} chunks loaded, {} requested, {} retired", 
+        num_chunks_loaded, chunks.size(), streamed.requested, streamed.retired).c_str(), 10, 35, 20, BLUE);
+      const RenderQueue::Counters& rq = render_queue.counters();
+      DrawText(format("- {} draw calls for {} items, {} shader / {} material changes", 
+        rq.draw_calls, rq.items, rq.shader_changes, rq.material_changes).c_str(), 15, 55, 18, BLUE);
+      DrawText(format("- {} roads, {} / {} vertices", num_roads, num_road_vertices, num_road_vertices_full).c_str(), 15, 73, 18, BLUE);
+      DrawText(format("culling: {} / {} chunks, {} / {} clusters culled, {} / {} buildings occluded", 
+        num_chunks_culled, chunks.size(), num_clusters_culled, num_clusters, 
+        occlusion.buildings_occluded, occlusion.buildings).c_str(), 10, 215, 18, DARKGRAY);
+      uint64_t lod_buildings = stats().buildings_meshed;
+      DrawText(format("detail levels: {} / {} / {} chunks, built in {:.2f} us per building", 
+        num_chunks_per_lod[0], num_chunks_per_lod[1], num_chunks_per_lod[2],
+        lod_buildings > 0 ? (double)stats().lod_ns / 1000.0 / lod_buildings : 0.0).c_str(), 10, 235, 18, DARKGRAY);
+      // timed on its own, it isn't part of what the map costs to draw
+      const DebugOverlay::Counters& overlay = debug_overlay.counters();
+      if (debug_overlay.enabled()) {
+        DrawText(format("debug overlay (F3): {} instances in {} draw calls, {:.3f} ms", 
+          overlay.instances, overlay.draw_calls, overlay.cpu_ms).c_str(), 10, 255, 18, DARKGRAY);
+      } else {
+        DrawText("debug overlay (F3): off", 10, 255, 18, DARKGRAY);
+      }
+
+      const Stats& st = stats();
+      uint64_t num_buildings = st.earcut_buildings();
+      if (num_buildings > 0) {
+        DrawText(format("earcut: {} quad / {} convex / {} concave, {:.2f} us per building on {} workers", 
+          st.earcut_quad.load(), st.earcut_convex.load(), st.earcut_concave.load(),
+          (double)st.earcut_ns / 1000.0 / num_buildings, worker_pool().size()).c_str(), 10, 95, 18, DARKGRAY);
+        DrawText(format("- {} hull fallbacks, {} degenerate", 
+          st.earcut_fallback.load(), st.earcut_degenerate.load()).c_str(), 15, 115, 18, DARKGRAY);
+      }
+      if (st.buildings_meshed > 0) {
+        DrawText(format("meshes: {} bytes per building", st.mesh_bytes / st.buildings_meshed).c_str(), 10, 135, 18, DARKGRAY);
+      }
+      if (st.upload_backlog_chunks > 0) {
+        DrawText(format("uploads: {} chunks / {} KB pending", 
+          st.upload_backlog_chunks.load(), st.upload_backlog_bytes / 1024).c_str(), 10, 155, 18, DARKGRAY);
+      }
+      DrawText(format("resident CPU geometry: {} KB", st.resident_mesh_bytes / 1024).c_str(), 10, 175, 18, DARKGRAY);
+      if (st.first_geometry_chunks > 0) {
+        // averaged over the chunks. Parsing waits for the whole download, on a slow link the first geometry
+        // comes after all of it
+        DrawText(format("streaming: {:.0f} ms download, then first geometry after {:.0f} ms, complete after {:.0f} ms ({} chunks)", 
+          st.download_ns / 1e6 / max<uint64_t>(st.download_chunks, 1), st.first_geometry_ns / 1e6 / st.first_geometry_chunks, 
+          st.complete_chunks > 0 ? st.complete_ns / 1e6 / st.complete_chunks : 0.0, st.complete_chunks.load()).c_str(), 10, 275, 18, DARKGRAY);
+      }
+      const ChunkCache::Usage& cached = cache.usage();
+      DrawText(format("cache: {} chunks, CPU {} / {} MB, GPU {} / {} MB, {} hits / {} misses, {} evictions", 
+        cached.chunks, cached.cpu_bytes >> 20, CACHE_BUDGET.cpu_bytes >> 20, cached.gpu_bytes >> 20, CACHE_BUDGET.gpu_bytes >> 20,
+        cached.hits, cached.misses, cached.evictions).c_str(), 10, 295, 18, DARKGRAY);
+      if (st.gpu_pool_slabs > 0) {
+        // occupancy of the slabs, and bytes lost to bucket rounding in the occupied ones
+        uint64_t occupied = st.gpu_pool_capacity_bytes - st.gpu_pool_free_bytes;
+        DrawText(format("gpu pool: {} slabs / {} KB, {:.0f}% occupied, {:.0f}% fragmented, {} reuses / {} allocations", 
+          st.gpu_pool_slabs.load(), st.gpu_pool_capacity_bytes / 1024, 
+          100.0 * occupied / st.gpu_pool_capacity_bytes, occupied > 0 ? 100.0 - 100.0 * st.gpu_pool_used_bytes / occupied : 0.0,
+          st.gpu_pool_reuses.load(), st.gpu_pool_allocations.load()).c_str(), 10, 195, 18, DARKGRAY);
+      }
     EndDrawing();
   }
 
+  for (auto& c : streamer.chunks())
+    c->unload();
+  cache.clear();
+  gpu_buffer_pool().trim();
+  debug_overlay.unload();
+  UnloadMaterial(road_mat);
   UnloadMaterial(mat);
   CloseWindow();
   return 0;
@@ -0,0 +1,47 @@
+#include "render_queue.hpp"
+#include <tuple>
+#include <cstdint>
+#include <algorithm>
+#include "rlgl.h"
+#include "gpu_mesh.hpp"
+
+using namespace std;
+
+// the shader, the material, then the depth front to back
+using SortKey = tuple<unsigned int, uintptr_t, float>;
+
+static SortKey sort_key(const DrawItem& item) {
+  return {item.draw.material->shader.id, (uintptr_t)item.draw.material, item.depth};
+}
+
+void RenderQueue::submit(DrawItem item) {
+  m.items.push_back(std::move(item));
+}
+
+void RenderQueue::flush() {
+  m.counters = Counters {.items = m.items.size()};
+
+  // submission order breaks the ties, the output is the same every frame for the same items
+  ranges::stable_sort(m.items, {}, sort_key);
+
+  unsigned int shader = 0;
+  const Material* material = nullptr;
+
+  for (const DrawItem& item : m.items) {
+    const MeshDraw& draw = item.draw;
+    if (draw.material->shader.id != shader) {
+      if (shader != 0) end_gpu_material();
+      begin_gpu_material(*draw.material);
+      shader = draw.material->shader.id;
+      ++m.counters.shader_changes;
+    }
+    if (draw.material != material) {
+      material = draw.material;
+      ++m.counters.material_changes;
+    }
+    m.counters.draw_calls += draw_bound_gpu_mesh(*draw.mesh, *draw.material, draw.transform, draw.ranges);
+  }
+
+  if (shader != 0) end_gpu_material();
+  m.items.clear();
+}
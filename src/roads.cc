@@ -0,0 +1,274 @@
+#include "roads.hpp"
+#include <string_view>
+#include <span>
+#include <future>
+#include <algorithm>
+#include <cmath>
+#include "map_data.hpp"
+#include "raymath.h"
+
+using namespace std;
+
+RoadClass road_class(const Way& road) {
+  auto highway_tag = road.tags.find(Tag::make_valueless("highway"));
+  if (highway_tag == road.tags.end()) return RoadClass::Residential;
+
+  string_view value = highway_tag->value;
+  // links share the class of the road they connect to
+  if (value.ends_with("_link")) value.remove_suffix(5);
+
+  if (value == "motorway" || value == "trunk") 
+    return RoadClass::Motorway;
+  if (value == "primary") 
+    return RoadClass::Primary;
+  if (value == "secondary" || value == "tertiary") 
+    return RoadClass::Secondary;
+  if (value == "footway" || value == "path" || value == "cycleway" || value == "steps" 
+    || value == "pedestrian" || value == "bridleway" || value == "track") 
+    return RoadClass::Path;
+  return RoadClass::Residential;
+}
+
+Color road_color(RoadClass road_class) {
+  switch (road_class) {
+    case RoadClass::Motorway:
+    return Color {226, 122, 143, 255};
+    case RoadClass::Primary:
+    return Color {236, 160, 70, 255};
+    case RoadClass::Secondary:
+    return Color {220, 200, 80, 255};
+    case RoadClass::Path:
+    return GRAY;
+    case RoadClass::Residential:
+    default:
+    return BLUE;
+  }
+}
+
+// in world units (1u = 10m)
+float road_width(RoadClass road_class) {
+  switch (road_class) {
+    case RoadClass::Motorway:
+    return 2.f;
+    case RoadClass::Primary:
+    return 1.2f;
+    case RoadClass::Secondary:
+    return .9f;
+    case RoadClass::Path:
+    return .25f;
+    case RoadClass::Residential:
+    default:
+    return .6f;
+  }
+}
+
+// Roads lie just above the ground planes. Where they overlap, larger classes are drawn on top
+static float road_elevation(RoadClass road_class) {
+  const float ROAD_ELEVATION = .05f;
+  const float CLASS_STEP = .01f;
+  return ROAD_ELEVATION + CLASS_STEP * (float)((int)RoadClass::Path - (int)road_class);
+}
+
+// joins sharper than this get a bevel, a miter would stick out more than twice the half width
+static const float MITER_LIMIT_COS = .5f;
+
+static inline float cross2(Vector2 a, Vector2 b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+// Detail levels of a chunk's roads, finest first. Classes below the smallest one kept are left out,
+// at the distances a level is drawn from they would be under a couple pixels wide
+struct RoadLevel {
+  float tolerance;
+  RoadClass smallest_class;
+};
+static const RoadLevel ROAD_LEVELS[] = {
+  {0.f, RoadClass::Path},
+  {.2f, RoadClass::Residential},
+  {1.f, RoadClass::Secondary},
+};
+
+static float segment_distance(Vector2 p, Vector2 a, Vector2 b) {
+  Vector2 ab = Vector2Subtract(b, a);
+  float len2 = Vector2DotProduct(ab, ab);
+  float t = len2 > 0.f ? clamp(Vector2DotProduct(Vector2Subtract(p, a), ab) / len2, 0.f, 1.f) : 0.f;
+  return Vector2Distance(p, Vector2Add(a, Vector2Scale(ab, t)));
+}
+
+// Douglas-Peucker, in place. The ends are always kept
+static void simplify_polyline(vector<Vector2>& points, float tolerance) {
+  if (points.size() < 3) return;
+
+  thread_local vector<bool> keep;
+  thread_local vector<pair<size_t, size_t>> spans;
+  keep.assign(points.size(), false);
+  keep.front() = keep.back() = true;
+  spans.clear();
+  spans.push_back({0, points.size() - 1});
+  while (!spans.empty()) {
+    auto [first, last] = spans.back();
+    spans.pop_back();
+    size_t farthest = first;
+    float farthest_distance = tolerance;
+    for (size_t i = first + 1; i < last; ++i) {
+      float d = segment_distance(points[i], points[first], points[last]);
+      if (d > farthest_distance) {
+        farthest = i;
+        farthest_distance = d;
+      }
+    }
+    if (farthest == first) continue;
+    keep[farthest] = true;
+    spans.push_back({first, farthest});
+    spans.push_back({farthest, last});
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < points.size(); ++i) {
+    if (keep[i]) points[kept++] = points[i];
+  }
+  points.resize(kept);
+}
+
+// Appends one road as a triangle list ribbon. Vertices are relative to origin
+void tessellate_road(const Way& road, Vector2 origin, vector<RoadVertex>& out, float tolerance) {
+  RoadClass rc = road_class(road);
+  float half_width = road_width(rc) * .5f;
+  float y = road_elevation(rc);
+
+  // projected once, consecutive duplicates would give segments without a direction
+  thread_local vector<Vector2> points;
+  points.clear();
+  for (const Node& n : road.nodes) {
+    Vector2 p = Vector2Subtract(to2DCoords(n.longitude, n.latitude), origin);
+    if (points.empty() || points.back().x != p.x || points.back().y != p.y) points.push_back(p);
+  }
+  if (tolerance > 0.f) simplify_polyline(points, tolerance);
+  if (points.size() < 2) return;
+
+  auto vertex = [&](Vector2 p) {
+    return RoadVertex {
+      .position = {p.x, y, p.y},
+      .feature = (uint8_t)rc,
+    };
+  };
+  // the ground is XZ, facing up means clockwise in (x, z)
+  auto triangle = [&](Vector2 a, Vector2 b, Vector2 cc) {
+    float area = cross2(Vector2Subtract(b, a), Vector2Subtract(cc, a));
+    if (area == 0.f) return;
+    if (area > 0.f) swap(b, cc);
+    out.push_back(vertex(a));
+    out.push_back(vertex(b));
+    out.push_back(vertex(cc));
+  };
+  auto normal_of = [&](size_t seg) {
+    Vector2 d = Vector2Normalize(Vector2Subtract(points[seg+1], points[seg]));
+    return Vector2 {-d.y, d.x};
+  };
+
+  // left/right edges where the current segment starts
+  Vector2 n = normal_of(0);
+  Vector2 left = Vector2Add(points[0], Vector2Scale(n, half_width));
+  Vector2 right = Vector2Subtract(points[0], Vector2Scale(n, half_width));
+
+  for (size_t seg = 0; seg + 1 < points.size(); ++seg) {
+    Vector2 p = points[seg+1];
+    n = normal_of(seg);
+    Vector2 end_left = Vector2Add(p, Vector2Scale(n, half_width));
+    Vector2 end_right = Vector2Subtract(p, Vector2Scale(n, half_width));
+    Vector2 next_left = end_left, next_right = end_right;
+
+    bool last = seg + 2 == points.size();
+    if (!last) {
+      Vector2 next_n = normal_of(seg+1);
+      Vector2 miter = Vector2Add(n, next_n);
+      float miter_len = Vector2Length(miter);
+      float cos_half = miter_len * .5f;
+
+      if (cos_half >= MITER_LIMIT_COS) {
+        // miter: both segments share the offset vertices of the join
+        miter = Vector2Scale(miter, half_width / (miter_len * cos_half));
+        end_left = next_left = Vector2Add(p, miter);
+        end_right = next_right = Vector2Subtract(p, miter);
+      } else {
+        // bevel: each segment keeps its own square end, the outer gap is closed by a triangle
+        next_left = Vector2Add(p, Vector2Scale(next_n, half_width));
+        next_right = Vector2Subtract(p, Vector2Scale(next_n, half_width));
+        bool turns_left = cross2(Vector2Subtract(p, points[seg]), Vector2Subtract(points[seg+2], p)) > 0.f;
+        if (turns_left) triangle(p, end_right, next_right);
+        else triangle(p, end_left, next_left);
+      }
+    }
+
+    triangle(left, right, end_right);
+    triangle(left, end_right, end_left);
+    left = next_left;
+    right = next_right;
+  }
+}
+
+static BoundingBox road_bounds(const vector<RoadVertex>& vertices, Vector2 origin) {
+  BoundingBox box {Vector3 {INFINITY, INFINITY, INFINITY}, Vector3 {-INFINITY, -INFINITY, -INFINITY}};
+  for (const RoadVertex& v : vertices) {
+    Vector3 p {v.position[0] + origin.x, v.position[1], v.position[2] + origin.y};
+    box.min = Vector3Min(box.min, p);
+    box.max = Vector3Max(box.max, p);
+  }
+  return box;
+}
+
+// Tessellates the roads of a level in slices across the pool's workers, appended to out
+static void tessellate_level(const vector<Way>& roads, Vector2 origin, const RoadLevel& level,
+  ThreadPool& pool, vector<RoadVertex>& out) {
+  // under that, dispatching a slice costs more than tessellating it
+  const size_t MIN_ROADS_PER_SLICE = 64;
+  const size_t SLICES_PER_WORKER = 4;
+
+  auto tessellate = [&level, origin](span<const Way> slice_roads, vector<RoadVertex>& slice) {
+    for (const Way& w : slice_roads) {
+      if (road_class(w) <= level.smallest_class) tessellate_road(w, origin, slice, level.tolerance);
+    }
+  };
+
+  size_t num_slices = clamp<size_t>(roads.size() / MIN_ROADS_PER_SLICE, 1, pool.size() * SLICES_PER_WORKER);
+  if (num_slices == 1 || pool.size() == 1) {
+    tessellate(roads, out);
+    return;
+  }
+
+  // slices are merged back in order, the output doesn't depend on the number of workers
+  vector<vector<RoadVertex>> slices(num_slices);
+  vector<future<void>> pending;
+  pending.reserve(num_slices);
+  for (size_t s = 0; s < num_slices; ++s) {
+    span<const Way> slice_roads(
+      roads.begin() + roads.size() * s / num_slices,
+      roads.begin() + roads.size() * (s+1) / num_slices
+    );
+    pending.push_back(pool.submit([&tessellate, &slice = slices[s], slice_roads]() {
+      tessellate(slice_roads, slice);
+    }));
+  }
+
+  for (future<void>& f : pending) f.get();
+
+  size_t num_vertices = out.size();
+  for (const auto& slice : slices) num_vertices += slice.size();
+  out.reserve(num_vertices);
+  for (const auto& slice : slices) out.insert(out.end(), slice.begin(), slice.end());
+}
+
+RoadMesh build_road_mesh(const vector<Way>& roads, Vector2 origin, ThreadPool& pool) {
+  RoadMesh mesh {.origin = origin};
+  for (const RoadLevel& level : ROAD_LEVELS) {
+    size_t first = mesh.vertices.size();
+    tessellate_level(roads, origin, level, pool, mesh.vertices);
+    mesh.lods.push_back(RoadLod {
+      .tolerance = level.tolerance,
+      .vertices = {(uint32_t)first, (uint32_t)(mesh.vertices.size() - first)},
+    });
+  }
+  mesh.bounds = road_bounds(mesh.vertices, origin);
+
+  return mesh;
+}
@@ -0,0 +1,6 @@
+#include "stats.hpp"
+
+Stats& stats() {
+  static Stats s {};
+  return s;
+}
@@ -0,0 +1,56 @@
+#include "thread_pool.hpp"
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t num_threads):
+  m {}
+{
+  num_threads = max<size_t>(num_threads, 1);
+  m.workers.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    m.workers.emplace_back([this]() { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard lock(m.mtx);
+    m.stopping = true;
+  }
+  m.cv.notify_all();
+
+  for (thread& t : m.workers) 
+    t.join();
+}
+
+future<void> ThreadPool::submit(function<void()> task) {
+  packaged_task<void()> packaged(std::move(task));
+  future<void> fut = packaged.get_future();
+  {
+    lock_guard lock(m.mtx);
+    m.tasks.push(std::move(packaged));
+  }
+  m.cv.notify_one();
+  return fut;
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    packaged_task<void()> task;
+    {
+      unique_lock lock(m.mtx);
+      m.cv.wait(lock, [this]() { return m.stopping || !m.tasks.empty(); });
+      // remaining tasks are still processed so that no future is left dangling
+      if (m.stopping && m.tasks.empty()) return;
+      task = std::move(m.tasks.front());
+      m.tasks.pop();
+    }
+    task();
+  }
+}
+
+ThreadPool& worker_pool() {
+  static ThreadPool pool(thread::hardware_concurrency());
+  return pool;
+}
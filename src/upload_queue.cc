@@ -0,0 +1,69 @@
+#include "upload_queue.hpp"
+#include "stats.hpp"
+#include "raymath.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+UploadQueue::UploadQueue(Budget budget):
+  m {.budget = budget}
+{}
+
+void UploadQueue::push(shared_ptr<Chunk> chunk) {
+  if (ranges::find(m.pending, chunk) != m.pending.end()) return;
+  m.pending.push_back(std::move(chunk));
+  update_stats();
+}
+
+void UploadQueue::process(Vector2 focus) {
+  if (m.pending.empty()) return;
+
+  // the focus moves between frames, so the order is recomputed each time. There are only a few chunks
+  auto distance_to_focus = [&focus](const shared_ptr<Chunk>& c) {
+    Vector2 center = Vector2Scale(Vector2Add(c->world_min, c->world_max), 0.5f);
+    return Vector2DistanceSqr(center, focus);
+  };
+  ranges::sort(m.pending, {}, distance_to_focus);
+
+  auto start = chrono::steady_clock::now();
+  size_t bytes = 0;
+  while (!m.pending.empty()) {
+    shared_ptr<Chunk>& chunk = m.pending.front();
+    bytes += chunk->upload_next_mesh();
+
+    if (chunk->pending_upload_bytes() == 0) {
+      // a streaming chunk comes back with its next part, a cached one was Generated already
+      if (!chunk->streaming && chunk->status != ChunkStatus::Generated) {
+        chunk->status = ChunkStatus::Generated;
+        stats().complete_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - chunk->downloaded_at).count();
+        ++stats().complete_chunks;
+      }
+      m.pending.erase(m.pending.begin());
+    }
+
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    if (elapsed.count() >= m.budget.max_ms || bytes >= m.budget.max_bytes) break;
+  }
+
+  update_stats();
+}
+
+void UploadQueue::clear() {
+  m.pending.clear();
+  update_stats();
+}
+
+void UploadQueue::remove(const shared_ptr<Chunk>& chunk) {
+  erase(m.pending, chunk);
+  update_stats();
+}
+
+void UploadQueue::update_stats() const {
+  size_t bytes = 0;
+  for (const auto& chunk : m.pending) {
+    bytes += chunk->pending_upload_bytes();
+  }
+  stats().upload_backlog_chunks = m.pending.size();
+  stats().upload_backlog_bytes = bytes;
+}
@@ -0,0 +1,73 @@
+// Headless checks of OcclusionBuffer, no window or GPU needed. The answers and the depth buffer's hash
+// are printed so that `make test` can compare the SIMD build with the NO_SIMD one
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include "raylib.h"
+#include "raymath.h"
+#include "occlusion.hpp"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+  if (!ok) ++failures;
+}
+
+static uint64_t hash_depth(const OcclusionBuffer& buffer) {
+  uint64_t h = 1469598103934665603ull;
+  for (float d : buffer.depth()) {
+    uint32_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    h = (h ^ bits) * 1099511628211ull;
+  }
+  return h;
+}
+
+// camera at (0, 1, 0) looking along +x
+static Matrix view_projection() {
+  Matrix view = MatrixLookAt(Vector3 {0.f, 1.f, 0.f}, Vector3 {10.f, 1.f, 0.f}, Vector3 {0.f, 1.f, 0.f});
+  Matrix projection = MatrixPerspective(45.f * DEG2RAD, 1.0, 0.01, 1000.0);
+  return MatrixMultiply(view, projection);
+}
+
+int main() {
+  OcclusionBuffer buffer(256, 256);
+  buffer.clear(view_projection());
+
+  BoundingBox behind {{8.f, .5f, -1.f}, {9.f, 1.5f, 1.f}};
+  BoundingBox beside {{8.f, .5f, 2.f}, {9.f, 1.5f, 3.f}};
+  BoundingBox in_front {{3.f, .5f, -.5f}, {3.5f, 1.5f, .5f}};
+  check(buffer.is_visible(behind) && buffer.is_visible(beside) && buffer.is_visible(in_front),
+    "an empty buffer hides nothing");
+
+  // a wall 5 units ahead, across the middle of the view
+  buffer.add_occluder(BoundingBox {{5.f, 0.f, -1.f}, {5.5f, 3.f, 1.f}});
+  check(!buffer.is_visible(behind), "a box behind the wall is hidden");
+  check(buffer.is_visible(beside), "a box beside the wall is visible");
+  check(buffer.is_visible(in_front), "a box in front of the wall is visible");
+  check(buffer.is_visible(BoundingBox {{8.f, 2.f, -1.f}, {9.f, 6.f, 1.f}}), "a box rising above the wall is visible");
+  printf("depth %016llx\n", (unsigned long long)hash_depth(buffer));
+
+  // random occluders and queries, for the SIMD and NO_SIMD builds to agree on
+  mt19937 rng(42);
+  auto unit = [&rng]() { return (float)(rng() / 4294967296.0); };
+  auto random_box = [&unit]() {
+    Vector3 min {2.f + 40.f * unit(), 0.f, -20.f + 40.f * unit()};
+    Vector3 size {.5f + 4.f * unit(), .5f + 6.f * unit(), .5f + 4.f * unit()};
+    return BoundingBox {min, Vector3Add(min, size)};
+  };
+  buffer.clear(view_projection());
+  for (int i = 0; i < 200; ++i) buffer.add_occluder(random_box());
+  printf("depth %016llx\n", (unsigned long long)hash_depth(buffer));
+  for (int line = 0; line < 16; ++line) {
+    char answers[65] = {};
+    for (int i = 0; i < 64; ++i) answers[i] = buffer.is_visible(random_box()) ? '1' : '0';
+    printf("%s\n", answers);
+  }
+
+  return failures == 0 ? 0 : 1;
+}